@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <atomic>
+#include "base_types.h"
+#include "LDAApi.h"
+
+#ifdef _WIN32
+	typedef __int64 INT64;
+#else
+	typedef long long INT64;
+#endif
+
+#ifndef MAX
+#define MAX(a,b)	((a) >= (b) ? (a) : (b))
+#endif
+
+#ifndef MIN
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#endif
+
+//   Batched solver for many small symmetric-definite pencils A*v = l*B*v,
+//   A symmetric and B symmetric positive definite, the LDA case (Sb, Sw).
+//
+//     B = L*L',  C = L^-1 * A * L^-T = U*diag(l)*U',  v = L^-T * u
+//
+//     BATCH_LANES pencils are interleaved element by element (element
+//     (i,j) of lane p at [(i*n + j)*BATCH_LANES + p]), so every step of the
+//     Cholesky factorization and of the reduction to C is one loop over the
+//     lanes that the compiler vectorizes. C is then taken apart and solved
+//     lane by lane with the tridiagonal QL solver, whose iteration count
+//     differs from lane to lane and which needs far fewer flops than a
+//     lockstep Jacobi sweep. Lane groups are spread over threads. A pencil
+//     that is not symmetric-definite goes to
+//     GeneralizedEigenvalueDecomposition on its own.
+
+#define BATCH_LANES		8
+#define BATCH_GRAIN		16		// lane groups claimed by a thread at a time
+
+int GeneralizedEigenvalueDecomposition(int n, double *a, double *b, double *eigenvector, double *eigenvalRe, double *eigenvalIm);
+int SymmetricEigenDecomposition(int n, double *a, double *w);
+void CholeskyBackward(int n, const double *l, int nrhs, double *b, int ldb);
+
+typedef struct BATCH {
+	INT n;
+	INT count;
+	const double *A;
+	const double *B;
+	double *eigenvector;
+	double *eigenvalue;
+	std::atomic<INT> next;
+	std::atomic<INT> fallback;
+	std::atomic<INT> status;
+} BATCH;
+
+// Eigenpairs of one pencil in the output convention: descending
+// eigenvalues, each eigenvector scaled to a largest component of 1.
+static void batch_store(INT n, double *V, double *w, double *eigenvector, double *eigenvalue)
+{
+	INT i, j, best;
+	double t;
+
+	for (i = 0; i < n; i++){
+		best = i;
+		for (j = i + 1; j < n; j++){
+			if (w[j] > w[best])
+				best = j;
+		}
+		t = w[i]; w[i] = w[best]; w[best] = t;
+		for (j = 0; j < n; j++){
+			t = V[j*n + i]; V[j*n + i] = V[j*n + best]; V[j*n + best] = t;
+		}
+
+		t = 0;
+		for (j = 0; j < n; j++){
+			if (fabs(V[j*n + i]) > fabs(t))
+				t = V[j*n + i];
+		}
+		for (j = 0; j < n; j++)
+			eigenvector[j*n + i] = (t != 0) ? V[j*n + i] / t : 0;
+		if (eigenvalue)
+			eigenvalue[i] = w[i];
+	}
+}
+
+// One pencil through the general QZ solver. a, b, V and w are n*n, n*n,
+// n*n and n scratch.
+static INT batch_general(INT n, const double *A, const double *B, double *a, double *b, double *V, double *w,
+	double *eigenvector, double *eigenvalue)
+{
+	memcpy(a, A, sizeof(double) * n * n);
+	memcpy(b, B, sizeof(double) * n * n);
+	if (GeneralizedEigenvalueDecomposition(n, a, b, V, w, NULL) != 0)
+		return -1;
+	batch_store(n, V, w, eigenvector, eigenvalue);
+	return 0;
+}
+
+// Solves the nl (<= BATCH_LANES) pencils starting at p0. a and b are
+// n*n*BATCH_LANES interleaved scratch, t 4*n*n + n.
+static INT batch_group(BATCH *pBatch, INT p0, INT nl, double *a, double *b, double *t)
+{
+	const INT L = BATCH_LANES;
+	INT n = pBatch->n;
+	INT nn = n * n;
+	INT i, j, k, l, p;
+	double *bi, *bj;
+	double s[BATCH_LANES];
+	BOOL bad[BATCH_LANES];
+	const double *A, *B;
+	double x;
+
+	// interleave; idle lanes get the pencil (0, I)
+	for (l = 0; l < L; l++){
+		bad[l] = FALSE;
+		if (l >= nl){
+			for (i = 0; i < nn; i++){
+				a[i*L + l] = 0;
+				b[i*L + l] = ((i % (n + 1)) == 0);
+			}
+			continue;
+		}
+		A = pBatch->A + (INT64)(p0 + l) * nn;
+		B = pBatch->B + (INT64)(p0 + l) * nn;
+		for (i = 0; i < nn; i++){
+			a[i*L + l] = A[i];
+			b[i*L + l] = B[i];
+		}
+		for (i = 0; i < n && !bad[l]; i++){
+			for (j = 0; j < i; j++){
+				if (fabs(A[i*n + j] - A[j*n + i]) > 1e-12 * (fabs(A[i*n + j]) + fabs(A[j*n + i])) ||
+					fabs(B[i*n + j] - B[j*n + i]) > 1e-12 * (fabs(B[i*n + j]) + fabs(B[j*n + i]))){
+					bad[l] = TRUE;
+					break;
+				}
+			}
+		}
+	}
+
+	// B = L*L', lower triangle of b
+	for (i = 0; i < n; i++){
+		bi = b + i * n * L;
+		for (j = 0; j <= i; j++){
+			bj = b + j * n * L;
+			for (l = 0; l < L; l++)
+				s[l] = bi[j*L + l];
+			for (k = 0; k < j; k++){
+				for (l = 0; l < L; l++)
+					s[l] -= bi[k*L + l] * bj[k*L + l];
+			}
+			if (i == j){
+				for (l = 0; l < L; l++){
+					if (!(s[l] > 0)){
+						bad[l] = TRUE;
+						s[l] = 1;
+					}
+					bi[i*L + l] = sqrt(s[l]);
+				}
+			}
+			else {
+				for (l = 0; l < L; l++)
+					bi[j*L + l] = s[l] / bj[j*L + l];
+			}
+		}
+	}
+
+	// a = L^-1 * A, then a = L^-1 * a' = L^-1 * A * L^-T
+	for (k = 0; k < 2; k++){
+		for (j = 0; j < n; j++){
+			for (i = 0; i < n; i++){
+				bi = b + i * n * L;
+				for (l = 0; l < L; l++)
+					s[l] = a[(i*n + j)*L + l];
+				for (p = 0; p < i; p++){
+					for (l = 0; l < L; l++)
+						s[l] -= bi[p*L + l] * a[(p*n + j)*L + l];
+				}
+				for (l = 0; l < L; l++)
+					a[(i*n + j)*L + l] = s[l] / bi[i*L + l];
+			}
+		}
+		if (k == 0){
+			for (i = 0; i < n; i++){
+				for (j = 0; j < i; j++){
+					for (l = 0; l < L; l++){
+						x = a[(i*n + j)*L + l];
+						a[(i*n + j)*L + l] = a[(j*n + i)*L + l];
+						a[(j*n + i)*L + l] = x;
+					}
+				}
+			}
+		}
+	}
+	for (i = 0; i < n; i++){
+		for (j = 0; j < i; j++){
+			for (l = 0; l < L; l++){
+				x = 0.5 * (a[(i*n + j)*L + l] + a[(j*n + i)*L + l]);
+				a[(i*n + j)*L + l] = x;
+				a[(j*n + i)*L + l] = x;
+			}
+		}
+	}
+
+	// de-interleave; each reduced matrix goes through the tridiagonal QL
+	// solver and back through L^-T. Pencils that failed take the general path
+	for (l = 0; l < nl; l++){
+		p = p0 + l;
+		if (!bad[l]){
+			for (i = 0; i < nn; i++){
+				t[i] = a[i*L + l];
+				t[nn + i] = b[i*L + l];
+			}
+			if (SymmetricEigenDecomposition(n, t, t + 2 * nn) != 0)
+				bad[l] = TRUE;
+		}
+		if (bad[l]){
+			if (batch_general(n, pBatch->A + (INT64)p * nn, pBatch->B + (INT64)p * nn, t, t + nn, t + 2 * nn,
+				t + 3 * nn, pBatch->eigenvector + (INT64)p * nn,
+				pBatch->eigenvalue ? pBatch->eigenvalue + (INT64)p * n : NULL) != 0)
+				return -1;
+			pBatch->fallback++;
+			continue;
+		}
+		CholeskyBackward(n, t + nn, n, t, n);
+		batch_store(n, t, t + 2 * nn, pBatch->eigenvector + (INT64)p * nn,
+			pBatch->eigenvalue ? pBatch->eigenvalue + (INT64)p * n : NULL);
+	}
+
+	return 0;
+}
+
+static void batch_worker(BATCH *pBatch)
+{
+	INT n = pBatch->n;
+	INT groups = (pBatch->count + BATCH_LANES - 1) / BATCH_LANES;
+	INT g, g0, p0;
+	double *a, *b, *t;
+
+	a = (double *)malloc(sizeof(double) * n * n * BATCH_LANES);
+	b = (double *)malloc(sizeof(double) * n * n * BATCH_LANES);
+	t = (double *)malloc(sizeof(double) * (4 * n * n + n));
+	if (a == NULL || b == NULL || t == NULL){
+		pBatch->status = -1;
+		goto L_EXIT;
+	}
+
+	while ((g0 = pBatch->next.fetch_add(BATCH_GRAIN)) < groups){
+		for (g = g0; g < MIN(groups, g0 + BATCH_GRAIN); g++){
+			p0 = g * BATCH_LANES;
+			if (batch_group(pBatch, p0, MIN(BATCH_LANES, pBatch->count - p0), a, b, t) != 0)
+				pBatch->status = -1;
+		}
+	}
+
+L_EXIT:
+
+	if (a)
+		free(a);
+	if (b)
+		free(b);
+	if (t)
+		free(t);
+}
+
+// Solves count independent n*n pencils, A and B holding them one after
+// the other, into the layout of LDA_Solve per pencil: eigenvector count
+// blocks of n*n (column i at row*n+i, largest component 1), eigenvalue
+// count rows of n in descending order. Returns the number of pencils that
+// were not symmetric-definite and went through the general solver, or -1.
+INT LDA_SolveBatch(INT n, INT count, const double *A, const double *B, double *eigenvector, double *eigenvalue)
+{
+	BATCH batch;
+	std::thread *worker;
+	INT i, groups, nThread;
+
+	if (n <= 0 || count < 0 || A == NULL || B == NULL || eigenvector == NULL)
+		return -1;
+	if (count == 0)
+		return 0;
+
+	batch.n = n;
+	batch.count = count;
+	batch.A = A;
+	batch.B = B;
+	batch.eigenvector = eigenvector;
+	batch.eigenvalue = eigenvalue;
+	batch.next = 0;
+	batch.fallback = 0;
+	batch.status = 0;
+
+	groups = (count + BATCH_LANES - 1) / BATCH_LANES;
+	nThread = MAX(1, MIN((groups + BATCH_GRAIN - 1) / BATCH_GRAIN, (INT)std::thread::hardware_concurrency()));
+	worker = new std::thread [nThread];
+	for (i = 0; i < nThread; i++)
+		worker[i] = std::thread(batch_worker, &batch);
+	for (i = 0; i < nThread; i++)
+		worker[i].join();
+	delete [] worker;
+
+	if (batch.status != 0)
+		return -1;
+	return batch.fallback;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "base_types.h"
+
+//   Cholesky factorization of a symmetric positive definite matrix and the
+//   triangular solves that go with it.
+//
+//     A = L * L'
+//
+//     The n*n matrix is row-major. Only the lower triangle is read, and it is
+//     overwritten by L; the strict upper triangle is left untouched. The
+//     right-hand sides of CholeskySolve are the columns of an n*nrhs
+//     row-major block with row stride ldb, so every update runs along a
+//     contiguous row of the block.
+
+// Returns 0, or -1 when a pivot is not positive (A not positive definite).
+int CholeskyDecomposition(int n, double *a)
+{
+	double *ai, *aj;
+	double s;
+	int i, j, k;
+
+	for (i = 0; i < n; i++)
+	{
+		ai = a + i * n;
+		for (j = 0; j <= i; j++)
+		{
+			aj = a + j * n;
+			s = ai[j];
+			for (k = 0; k < j; k++)
+				s -= ai[k] * aj[k];
+			if (i == j)
+			{
+				if (s <= 0)
+					return -1;
+				ai[i] = sqrt(s);
+			}
+			else
+				ai[j] = s / aj[j];
+		}
+	}
+
+	return 0;
+}
+
+// B = L^-1 * B
+void CholeskyForward(int n, const double *l, int nrhs, double *b, int ldb)
+{
+	const double *li;
+	double *bi, *bj;
+	double t;
+	int i, j, c;
+
+	for (i = 0; i < n; i++)
+	{
+		li = l + i * n;
+		bi = b + i * ldb;
+		for (j = 0; j < i; j++)
+		{
+			t = li[j];
+			bj = b + j * ldb;
+			for (c = 0; c < nrhs; c++)
+				bi[c] -= t * bj[c];
+		}
+		t = 1.0 / li[i];
+		for (c = 0; c < nrhs; c++)
+			bi[c] *= t;
+	}
+}
+
+// B = L'^-1 * B
+void CholeskyBackward(int n, const double *l, int nrhs, double *b, int ldb)
+{
+	double *bi, *bj;
+	double t;
+	int i, j, c;
+
+	for (i = n - 1; i >= 0; i--)
+	{
+		bi = b + i * ldb;
+		t = 1.0 / l[i * n + i];
+		for (c = 0; c < nrhs; c++)
+			bi[c] *= t;
+		// column i of L, below the diagonal, applied to the rows above
+		for (j = 0; j < i; j++)
+		{
+			t = l[i * n + j];
+			bj = b + j * ldb;
+			for (c = 0; c < nrhs; c++)
+				bj[c] -= t * bi[c];
+		}
+	}
+}
+
+// B = A^-1 * B, with L from CholeskyDecomposition
+void CholeskySolve(int n, const double *l, int nrhs, double *b, int ldb)
+{
+	CholeskyForward(n, l, nrhs, b, ldb);
+	CholeskyBackward(n, l, nrhs, b, ldb);
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FileMap.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+int FileMap_Open(FILEMAP *pMap, const char *path, BOOL bWrite, INT64 size)
+{
+	if (pMap == NULL || path == NULL)
+		return -1;
+
+	memset(pMap, 0, sizeof(*pMap));
+	pMap->bWrite = bWrite;
+
+#ifdef _WIN32
+	HANDLE hFile, hMap;
+	LARGE_INTEGER li;
+
+	hFile = CreateFileA(path, bWrite ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+		FILE_SHARE_READ, NULL, (size > 0) ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return -1;
+
+	if (size > 0){
+		li.QuadPart = size;
+		if (!SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) || !SetEndOfFile(hFile)){
+			CloseHandle(hFile);
+			return -1;
+		}
+	}
+	if (!GetFileSizeEx(hFile, &li) || li.QuadPart == 0){
+		CloseHandle(hFile);
+		return -1;
+	}
+	pMap->size = li.QuadPart;
+
+	hMap = CreateFileMappingA(hFile, NULL, bWrite ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+	if (hMap == NULL){
+		CloseHandle(hFile);
+		return -1;
+	}
+	pMap->base = MapViewOfFile(hMap, bWrite ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+	if (pMap->base == NULL){
+		CloseHandle(hMap);
+		CloseHandle(hFile);
+		return -1;
+	}
+	pMap->hFile = hFile;
+	pMap->hMap = hMap;
+#else
+	struct stat st;
+	int fd;
+
+	fd = open(path, bWrite ? (O_RDWR | ((size > 0) ? O_CREAT : 0)) : O_RDONLY, 0644);
+	if (fd < 0)
+		return -1;
+
+	if (size > 0 && ftruncate(fd, (off_t)size) != 0){
+		close(fd);
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0){
+		close(fd);
+		return -1;
+	}
+	pMap->size = st.st_size;
+
+	pMap->base = mmap(NULL, (size_t)pMap->size, bWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	if (pMap->base == MAP_FAILED){
+		pMap->base = NULL;
+		close(fd);
+		return -1;
+	}
+	pMap->fd = fd;
+#endif
+
+	return 0;
+}
+
+int FileMap_Sync(FILEMAP *pMap)
+{
+	if (pMap == NULL || pMap->base == NULL)
+		return -1;
+	if (!pMap->bWrite)
+		return 0;
+#ifdef _WIN32
+	if (!FlushViewOfFile(pMap->base, 0))
+		return -1;
+#else
+	if (msync(pMap->base, (size_t)pMap->size, MS_SYNC) != 0)
+		return -1;
+#endif
+	return 0;
+}
+
+int FileMap_Close(FILEMAP *pMap)
+{
+	if (pMap == NULL || pMap->base == NULL)
+		return -1;
+#ifdef _WIN32
+	UnmapViewOfFile(pMap->base);
+	CloseHandle((HANDLE)pMap->hMap);
+	CloseHandle((HANDLE)pMap->hFile);
+#else
+	munmap(pMap->base, (size_t)pMap->size);
+	close(pMap->fd);
+#endif
+	memset(pMap, 0, sizeof(*pMap));
+	return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef __FileMap_h__
+#define __FileMap_h__
+
+#include "base_types.h"
+
+#ifdef _WIN32
+	typedef __int64 INT64;
+#else
+	typedef long long INT64;
+#endif
+
+// Read-only or read-write view of a whole file. When a size is given to
+// FileMap_Open the file is created (or resized) to that many bytes first.
+typedef struct FILEMAP {
+	void *base;
+	INT64 size;
+	BOOL bWrite;
+#ifdef _WIN32
+	void *hFile;
+	void *hMap;
+#else
+	int fd;
+#endif
+} FILEMAP;
+
+int FileMap_Open(FILEMAP *pMap, const char *path, BOOL bWrite, INT64 size);
+int FileMap_Sync(FILEMAP *pMap);
+int FileMap_Close(FILEMAP *pMap);
+
+#endif	//__FileMap_h__
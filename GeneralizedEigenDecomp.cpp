@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <chrono>
 #include "base_types.h"
+#include "LDAApi.h"
+#include "LDAPerf.h"
 
 #undef ABS
 #undef SIGN
@@ -46,7 +49,7 @@
 // 
 
 static int qzhes(int n, double **a, double **b, BOOL matz, double **z);
-static int qzit(int n, double **a, double **b, double eps1, BOOL matz, double **z, int *ierr);
+static int qzit(int n, double **a, double **b, double eps1, BOOL matz, double **z, int *ierr, int *iter, int *defl);
 static int qzval(int n, double **a, double **b, double *alfr, double *alfi, double *beta, BOOL matz, double **z);
 static int qzvec(int n, double **a, double **b, double *alfr, double *alfi, double *beta, double **z);
 
@@ -77,7 +80,25 @@ static int _compare(const void *a, const void *b)
 	return 0;
 }
 
+static double _seconds(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int GeneralizedEigenvalueDecompositionStats(int n, double *a, double *b, double *eigenvector, double *eigenvalRe,
+	double *eigenvalIm, LDA_STATS *pStats);
+
 int GeneralizedEigenvalueDecomposition(int n, double *a, double *b, double *eigenvector, double *eigenvalRe, double *eigenvalIm)
+{
+	return GeneralizedEigenvalueDecompositionStats(n, a, b, eigenvector, eigenvalRe, eigenvalIm, NULL);
+}
+
+// As GeneralizedEigenvalueDecomposition; pStats, if not NULL, receives the
+// time spent in each QZ stage, the iteration and deflation counts, the
+// number of infinite eigenvalues and a condition estimate of b. Returns -1
+// if the QZ iteration fails to converge.
+int GeneralizedEigenvalueDecompositionStats(int n, double *a, double *b, double *eigenvector, double *eigenvalRe,
+	double *eigenvalIm, LDA_STATS *pStats)
 {
 	double **A = NULL;
 	double **B = NULL;
@@ -90,9 +111,14 @@ int GeneralizedEigenvalueDecomposition(int n, double *a, double *b, double *eige
 
 	BOOL matz = TRUE;
 	int ierr = 0;
+	int iter = 0;
+	int defl = 0;
+	int ret = -1;
 
 	double *pa, *pb;
-	int i, j, k;
+	LDAPERFMARK mark;
+	double t0, t1, epsb, bmin, bmax;
+	int i, j, k, inf;
 
 	if (a == NULL || b == NULL || n <= 0)
 		return -1;
@@ -126,22 +152,77 @@ int GeneralizedEigenvalueDecomposition(int n, double *a, double *b, double *eige
 
 	// reduces A to upper Hessenberg form and B to upper
 	// triangular form using orthogonal transformations
+	lda_perf_begin(&mark);
+	t0 = _seconds();
 	qzhes(n, A, B, matz, Z);
+	t1 = _seconds();
+	lda_perf_end(&mark, LDA_PERF_QZHES);
+	if (pStats)
+		pStats->tQzhes = t1 - t0;
+
+	// B = Q' b Z is now triangular, the ratio of its extreme diagonal
+	// entries bounds the reciprocal condition of b from above
+	bmin = bmax = ABS(B[0][0]);
+	for (i = 1; i < n; i++)
+	{
+		if (ABS(B[i][i]) < bmin)
+			bmin = ABS(B[i][i]);
+		if (ABS(B[i][i]) > bmax)
+			bmax = ABS(B[i][i]);
+	}
+	if (pStats)
+		pStats->rcond = bmax > 0 ? bmin / bmax : 0;
 
 	// reduces the Hessenberg matrix A to quasi-triangular form
 	// using orthogonal transformations while maintaining the
 	// triangular form of the B matrix.
-	qzit(n, A, B, kDoubleEpsilon, matz, Z, &ierr);
+	lda_perf_begin(&mark);
+	t1 = _seconds();
+	qzit(n, A, B, kDoubleEpsilon, matz, Z, &ierr, &iter, &defl);
+	t0 = _seconds();
+	lda_perf_end(&mark, LDA_PERF_QZIT);
+	if (pStats)
+	{
+		pStats->tQzit = t0 - t1;
+		pStats->nIter = iter;
+		pStats->nDeflate = defl;
+		pStats->ierr = ierr;
+	}
+	if (ierr != 0)
+		goto L_EXIT;
 
 	// reduces the quasi-triangular matrix further, so that any
 	// remaining 2-by-2 blocks correspond to pairs of complex
 	// eigenvalues, and returns quantities whose ratios give the
 	// generalized eigenvalues.
+	lda_perf_begin(&mark);
+	t0 = _seconds();
 	qzval(n, A, B, ar, ai, beta, matz, Z);
+	t1 = _seconds();
+	lda_perf_end(&mark, LDA_PERF_QZVAL);
+	if (pStats)
+		pStats->tQzval = t1 - t0;
+
+	// beta at round-off level, qzit leaves its threshold in B
+	epsb = n > 1 ? B[n-1][0] : kDoubleEpsilon * ABS(B[0][0]);
+	inf = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (ABS(beta[i]) <= epsb)
+			inf++;
+	}
+	if (pStats)
+		pStats->nInfinite = inf;
 
 	// computes the eigenvectors of the triangular problem and
 	// transforms the results back to the original coordinate system.
+	lda_perf_begin(&mark);
+	t1 = _seconds();
 	qzvec(n, A, B, ar, ai, beta, Z);
+	t0 = _seconds();
+	lda_perf_end(&mark, LDA_PERF_QZVEC);
+	if (pStats)
+		pStats->tQzvec = t0 - t1;
 
 	// Sort eigenvalues and vectors in descending order
 	pSort = new Sort [n];
@@ -181,6 +262,9 @@ int GeneralizedEigenvalueDecomposition(int n, double *a, double *b, double *eige
 			eigenvalIm[i] = ai[j] / beta[j];
 		}
 	}
+	ret = 0;
+
+L_EXIT:
 
 	delete [] A[0];
 	delete [] A;
@@ -194,7 +278,7 @@ int GeneralizedEigenvalueDecomposition(int n, double *a, double *b, double *eige
 	delete [] beta;
 	delete [] pSort;
 
-	return 0;
+	return ret;
 }
 
 static double Epslon(double x)
@@ -366,7 +450,7 @@ static int qzhes(int n, double **a, double **b, BOOL matz, double **z)
 	return 0;
 }
 
-static int qzit(int n, double **a, double **b, double eps1, BOOL matz, double **z, int *ierr)
+static int qzit(int n, double **a, double **b, double eps1, BOOL matz, double **z, int *ierr, int *iter, int *defl)
 {
 	int i, j, k, l = 0;
 	double r, s, t, a1, a2, a3 = 0;
@@ -386,6 +470,7 @@ static int qzit(int n, double **a, double **b, double eps1, BOOL matz, double **
 	BOOL notlas;
 
 	*ierr = 0;
+	*defl = 0;
 
 	// Compute epsa and epsb
 	for (i = 0; i < n; ++i)
@@ -454,6 +539,7 @@ L90:
 	if (l < na) goto L95;
 
 	// 1-by-1 or 2-by-2 block isolated
+	++(*defl);
 	en = lm1;
 	goto L60;
 
@@ -743,6 +829,7 @@ L1000:
 L1001:
 	if (n > 1)
 	    b[n - 1][0] = epsb;
+	*iter = n * 30 - itn;
 
 	return 0;
 }
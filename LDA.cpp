@@ -2,8 +2,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 #include "base_types.h"
 #include "LDAApi.h"
+#include "LDAKernel.h"
+#include "LDAPerf.h"
 
 #ifdef _WIN32
 	typedef __int64 INT64;
@@ -12,91 +19,321 @@
 #endif
 
 int GeneralizedEigenvalueDecomposition(int n, double *a, double *b, double *eigenvector, double *eigenvalRe, double *eigenvalIm);
+int GeneralizedEigenvalueDecompositionStats(int n, double *a, double *b, double *eigenvector, double *eigenvalRe,
+	double *eigenvalIm, LDA_STATS *pStats);
+int SymmetricEigenDecomposition(int n, double *a, double *w);
 
-static int mat_mul(const double x[], const int xx, const int xy, const double y[], const int yx, const int yy, double a[])
+//=============================================================================
+
+#ifndef MAX
+#define MAX(a,b)	((a) >= (b) ? (a) : (b))
+#endif
+
+#ifndef MIN
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#endif
+
+// rows per block of the batch kernels
+#define LDA_BLOCK	64
+
+// blocks prepared per parallel pass of the batch kernels, and rows of S
+// claimed by a thread at a time
+#define LDA_PAR_BLOCKS	32
+#define LDA_PAR_ROWS	4
+
+// Running sums of one accumulation epoch, taken around the per-class
+// shift K[k] of the handle (the first sample of the class): with
+// y = x - K[k], S[k] holds the upper triangle of sum(w*y*y'), C[k] the sum
+// of w*y and N[k] the sum of w. Shifted sums stay small next to the
+// scatter they produce, so removing the mean does not cancel digits away
+// even for large offsets. Every sample has unit weight unless the handle
+// decays; then all sums are stored relative to the weight 2^t0 and a
+// reader scales them by 2^(t0 - t) at time t.
+typedef struct ACCUM {
+	INT d;
+	INT q;
+	INT count;			// samples
+	double t0;			// log2 weight reference
+	double *N;
+	double **S;
+	double **C;
+} ACCUM;
+
+// Result of one solve.
+typedef struct SOLUTION {
+	double *W;			// eigenvectors
+	double *lambda;		// eigenvalues
+	double *M;			// q*d class means
+	double *Nk;			// (weighted) samples per class
+	INT nSolved;		// samples seen by the solve
+	double *scale;		// per-eigenvector scale to unit within-class variance
+	double *centroid;	// q*kc class means in the scaled discriminant space
+	double *logPrior;	// log(Nk/sum(Nk))
+	INT kc;				// discriminants used by LDA_Classify
+} SOLUTION;
+
+// Quadratic discriminant of the last LDA_SolveQDA. Class c scores
+//   -0.5 * |L[c]^-1 * (x - M[c])|^2 + bias[c] (+ logPrior[c])
+// with L[c] the Cholesky factor of its regularized covariance and
+// bias[c] = -0.5 * log|Sigma[c]|, the log-likelihood up to a constant.
+typedef struct QDA {
+	double *L;			// q*d*d, lower triangles
+	double *M;			// q*d
+	double *bias;		// q, -HUGE_VAL for an empty class
+	double *logPrior;	// q
+	BOOL bSolved;
+} QDA;
+
+// Background solves. Once LDA_AcquireModel or LDA_SolveAsync has been
+// used on a handle, every solve publishes a model in 'current'. Readers
+// take their reference under pubLock, which is only held to exchange or
+// retain the pointer, and the publisher releases the model it replaced
+// afterwards; the models are refcounted, so no reader waits on another.
+typedef struct ASYNC {
+	std::thread worker;			// guarded by joinLock
+	std::mutex joinLock;
+	BOOL bBusy;					// worker running, guarded by LDA::lock
+	INT status;					// result of the last background solve
+	std::atomic<bool> bPublish;	// set under LDA::solLock, never cleared
+	HANDLE current;				// guarded by pubLock
+	std::mutex pubLock;
+	INT published;				// samples behind the current model
+} ASYNC;
+
+typedef struct LDA {
+	INT count;				// samples over all epochs
+	INT d;
+	INT q;
+	ACCUM *acc;				// epoch receiving new samples
+	ACCUM *frozen;			// epoch being merged into base by the worker
+	ACCUM *base;			// epochs already handed to LDA_SolveAsync
+	ACCUM *spare;			// cleared epoch swapped in by the next LDA_SolveAsync
+	std::mutex *lock;		// guards count, acc, frozen and spare
+	std::mutex *baseLock;	// guards base, taken before lock
+	BOOL bTrained;
+
+	// per-class shift, set by the first sample of the class and fixed
+	// from then on, so the epochs of a handle can be added up
+	double *shift;			// q*d
+	BOOL *bShift;
+	double *work;			// LDA_BLOCK*d shifted rows + q*d partial sums
+	INT *cls;				// classes present in a block
+	INT nThread;			// threads of the batch kernels, see LDA_SetThreads
+
+	// exponential forgetting: the weight of a new sample grows by 2^rate,
+	// i.e. each sample ages every older one by 2^-rate
+	double rate;			// 1/half-life in samples, 0 keeps every sample
+	double t;				// log2 weight of the newest sample
+
+	// sliding window: acc is the open block, ring holds the closed ones
+	// and closed their sum, maintained by adding and subtracting blocks
+	ACCUM **ring;
+	INT nRing;
+	INT head;				// oldest closed block
+	INT block;				// samples per block, 0 when not windowed
+	ACCUM *closed;
+
+	// result of the last LDA_Solve/LDA_SolveSnapshot/LDA_SolveUpdate. A
+	// solve builds its own and exchanges it under solLock, which readers
+	// hold while they use sol, so a snapshot can refresh the model of a
+	// handle that is classifying
+	SOLUTION sol;
+	std::mutex *solLock;
+	LDA_STATS stats;		// its phases, guarded by lock
+	QDA qda;				// exchanged under solLock like sol
+	ASYNC *pAsync;
+
+	// scatter shared by the feature-subset and regularization queries,
+	// rebuilt when samples have arrived since
+	std::mutex *subLock;
+	double *subSw;			// d*d
+	double *subB;			// d*q, Sb = B*B'
+	double subN;			// total weight
+	INT subCount;			// samples behind subSw/subB, -1 before the first
+} LDA;
+
+static void acc_release(ACCUM *pAcc)
+{
+	if (pAcc == NULL)
+		return;
+	if (pAcc->N)
+		free(pAcc->N);
+	if (pAcc->S && pAcc->S[0])
+		free(pAcc->S[0]);
+	if (pAcc->S)
+		free(pAcc->S);
+	if (pAcc->C && pAcc->C[0])
+		free(pAcc->C[0]);
+	if (pAcc->C)
+		free(pAcc->C);
+	free(pAcc);
+}
+
+static ACCUM *acc_create(INT d, INT q)
 {
-	int i, j, k;
-	double *wx, *wy, *wa;
-	double *t = NULL;
+	ACCUM *pAcc;
+	INT i;
 
-	if (xy != yx || xx == 0 || yy == 0) {
-		fprintf(stderr, "Invalid matrix size x= %d*%d,y= %d*%d\n", xx, xy, yx, yy);
-		return -1;
-	}
+	pAcc = (ACCUM *)calloc(1, sizeof(*pAcc));
+	if (pAcc == NULL)
+		return NULL;
 
-	wx = (double *)x;
-	wa = a;
-	if (x == a || y == a) {
-		t = new double [xx * yy];
-		wa = t;
+	pAcc->d = d;
+	pAcc->q = q;
+	pAcc->N = (double *)calloc(q, sizeof(double));
+	pAcc->S = (double **)calloc(q, sizeof(double *));
+	pAcc->C = (double **)calloc(q, sizeof(double *));
+	if (pAcc->N == NULL || pAcc->S == NULL || pAcc->C == NULL){
+		acc_release(pAcc);
+		return NULL;
 	}
-
-	for (i = 0; i < xx; i++) {
-		for (j = 0; j < yy; j++) {
-			wy = (double *)&y[j];
-			*wa = 0;
-			for (k = 0; k < xy; k++) {
-				*wa += (double)(*wx) * (double)(*wy);
-				wx++;
-				wy += yy;
-			}
-			wx -= xy;
-			wa++;
-		}
-		wx += xy;
+	pAcc->S[0] = (double *)calloc(q * d * d, sizeof(double));
+	pAcc->C[0] = (double *)calloc(q * d, sizeof(double));
+	if (pAcc->S[0] == NULL || pAcc->C[0] == NULL){
+		acc_release(pAcc);
+		return NULL;
 	}
-
-	if (t) {
-		memcpy(a, t, sizeof(double) * (xx * yy));
-		delete [] t;
+	for (i = 1; i < q; i++){
+		pAcc->S[i] = pAcc->S[i-1] + (d * d);
+		pAcc->C[i] = pAcc->C[i-1] + d;
 	}
 
-	return 0;
+	return pAcc;
+}
+
+static void acc_clear(ACCUM *pAcc, double t0)
+{
+	INT d = pAcc->d;
+	INT q = pAcc->q;
+
+	pAcc->count = 0;
+	pAcc->t0 = t0;
+	memset(pAcc->N, 0, sizeof(double) * q);
+	memset(pAcc->S[0], 0, sizeof(double) * q * d * d);
+	memset(pAcc->C[0], 0, sizeof(double) * q * d);
 }
 
-static int mat_add(const double x[], const double y[], const int xx, const int xy, double a[])
+// Moves the weight reference to t0; sums that fall below the double
+// range have decayed away and become zero.
+static void acc_rescale(ACCUM *pAcc, double t0)
 {
-	int i, n;
-	n = xx * xy;
+	INT d = pAcc->d;
+	INT q = pAcc->q;
+	double f;
+	INT i, n;
+
+	if (t0 == pAcc->t0)
+		return;
+	f = exp2(pAcc->t0 - t0);
+	n = q * d * d;
 	for (i = 0; i < n; i++)
-		a[i] = x[i] + y[i];
-	return 0;
+		pAcc->S[0][i] *= f;
+	n = q * d;
+	for (i = 0; i < n; i++)
+		pAcc->C[0][i] *= f;
+	for (i = 0; i < q; i++)
+		pAcc->N[i] *= f;
+	pAcc->t0 = t0;
 }
 
-static int mat_scal(const double x[], const int xx, const int xy, const double scaler, double a[])
+// dst += sign * src, on the newer of the two weight references
+static void acc_merge(ACCUM *dst, ACCUM *src, double sign)
 {
-	int i, n;
-	n = xx * xy;
+	INT d = dst->d;
+	INT q = dst->q;
+	INT i, n;
+
+	if (dst->t0 < src->t0)
+		acc_rescale(dst, src->t0);
+	else
+		acc_rescale(src, dst->t0);
+
+	n = q * d * d;
 	for (i = 0; i < n; i++)
-		a[i] = x[i] * scaler;
-	return 0;
+		dst->S[0][i] += sign * src->S[0][i];
+	n = q * d;
+	for (i = 0; i < n; i++)
+		dst->C[0][i] += sign * src->C[0][i];
+	for (i = 0; i < q; i++)
+		dst->N[i] += sign * src->N[i];
+	dst->count += (sign > 0) ? src->count : -src->count;
 }
 
-//=============================================================================
+static void sol_free(SOLUTION *pSol)
+{
+	if (pSol->W)
+		free(pSol->W);
+	if (pSol->lambda)
+		free(pSol->lambda);
+	if (pSol->M)
+		free(pSol->M);
+	if (pSol->Nk)
+		free(pSol->Nk);
+	if (pSol->scale)
+		free(pSol->scale);
+	if (pSol->centroid)
+		free(pSol->centroid);
+	if (pSol->logPrior)
+		free(pSol->logPrior);
+	memset(pSol, 0, sizeof(*pSol));
+}
 
-#ifndef MAX
-#define MAX(a,b)	((a) >= (b) ? (a) : (b))
-#endif
+static INT sol_alloc(SOLUTION *pSol, INT d, INT q)
+{
+	if (pSol->W == NULL){
+		pSol->W = (double *)malloc(sizeof(double) * d * d);
+		pSol->lambda = (double *)malloc(sizeof(double) * d);
+		pSol->M = (double *)malloc(sizeof(double) * q * d);
+		pSol->Nk = (double *)malloc(sizeof(double) * q);
+		pSol->scale = (double *)malloc(sizeof(double) * d);
+		pSol->centroid = (double *)malloc(sizeof(double) * q * d);
+		pSol->logPrior = (double *)malloc(sizeof(double) * q);
+	}
+	if (pSol->W == NULL || pSol->lambda == NULL || pSol->M == NULL || pSol->Nk == NULL ||
+		pSol->scale == NULL || pSol->centroid == NULL || pSol->logPrior == NULL){
+		sol_free(pSol);
+		return -1;
+	}
+	return 0;
+}
 
-#ifndef MIN
-#define MIN(a,b)	((a) <= (b) ? (a) : (b))
-#endif
+// A private copy of the handle's solution; -1 if it has none.
+static INT lda_copy_sol(LDA *pLDA, SOLUTION *pSol)
+{
+	INT d = pLDA->d;
+	INT q = pLDA->q;
 
-typedef struct LDA {
-	INT count;
-	INT d;
-	INT q;
-	INT *N;
-	double **S;
-	double **C;
-	double *mean;
-	BOOL bTrained;
-} LDA;
+	std::lock_guard<std::mutex> lk(*pLDA->solLock);
+	if (pLDA->sol.W == NULL || sol_alloc(pSol, d, q) != 0)
+		return -1;
+	memcpy(pSol->W, pLDA->sol.W, sizeof(double) * d * d);
+	memcpy(pSol->lambda, pLDA->sol.lambda, sizeof(double) * d);
+	memcpy(pSol->M, pLDA->sol.M, sizeof(double) * q * d);
+	memcpy(pSol->Nk, pLDA->sol.Nk, sizeof(double) * q);
+	memcpy(pSol->scale, pLDA->sol.scale, sizeof(double) * d);
+	memcpy(pSol->centroid, pLDA->sol.centroid, sizeof(double) * q * d);
+	memcpy(pSol->logPrior, pLDA->sol.logPrior, sizeof(double) * q);
+	pSol->nSolved = pLDA->sol.nSolved;
+	pSol->kc = pLDA->sol.kc;
+	return 0;
+}
+
+static void qda_free(QDA *pQDA)
+{
+	if (pQDA->L)
+		free(pQDA->L);
+	if (pQDA->M)
+		free(pQDA->M);
+	if (pQDA->bias)
+		free(pQDA->bias);
+	if (pQDA->logPrior)
+		free(pQDA->logPrior);
+	memset(pQDA, 0, sizeof(*pQDA));
+}
 
 HANDLE LDA_Create(INT d, INT q)
 {
 	LDA *pLDA = NULL;
-	INT i;
 
 	if (d <= 0 || q <= 0 || q > d)
 		return NULL;
@@ -110,30 +347,28 @@ HANDLE LDA_Create(INT d, INT q)
 	pLDA->d = d;
 	pLDA->q = q;
 	pLDA->count = 0;
-	pLDA->N = (INT *)calloc(q, sizeof(INT));
-	pLDA->S = (double **)calloc(q, sizeof(double *));
-	pLDA->C = (double **)calloc(q, sizeof(double *));
-	if (pLDA->N == NULL || pLDA->S == NULL || pLDA->C == NULL){
-		LDA_Release((HANDLE)pLDA);
-		return NULL;
-	}
-	pLDA->S[0] = (double *)calloc(q * d * d, sizeof(double));
-	pLDA->C[0] = (double *)calloc(q * d, sizeof(double));
-	if (pLDA->S[0] == NULL || pLDA->C[0] == NULL){
+	pLDA->acc = acc_create(d, q);
+	pLDA->base = acc_create(d, q);
+	pLDA->shift = (double *)calloc(q * d, sizeof(double));
+	pLDA->bShift = (BOOL *)calloc(q, sizeof(BOOL));
+	pLDA->work = (double *)malloc(sizeof(double) * (LDA_BLOCK + q) * d);
+	pLDA->cls = (INT *)malloc(sizeof(INT) * q);
+	if (pLDA->acc == NULL || pLDA->base == NULL || pLDA->shift == NULL || pLDA->bShift == NULL ||
+		pLDA->work == NULL || pLDA->cls == NULL){
 		LDA_Release((HANDLE)pLDA);
 		return NULL;
 	}
-	for (i = 1; i < q; i++){
-		pLDA->S[i] = pLDA->S[i-1] + (d * d);
-		pLDA->C[i] = pLDA->C[i-1] + d;
-	}
 
-    pLDA->mean = (double *)calloc(d, sizeof(double));
-	if (pLDA->mean == NULL){
-		LDA_Release((HANDLE)pLDA);
-		return NULL;
-	}
+	pLDA->lock = new std::mutex;
+	pLDA->baseLock = new std::mutex;
+	pLDA->subLock = new std::mutex;
+	pLDA->solLock = new std::mutex;
+	pLDA->subCount = -1;
+	pLDA->pAsync = new ASYNC();
+	pLDA->pAsync->current = NULL;
+	pLDA->pAsync->bPublish = false;
 
+	pLDA->nThread = 1;
 	pLDA->bTrained = FALSE;
 
     return pLDA;
@@ -142,110 +377,988 @@ HANDLE LDA_Create(INT d, INT q)
 INT LDA_Release(HANDLE hLDA)
 {
 	LDA *pLDA = (LDA *)hLDA;
+	INT i;
 	if (pLDA == NULL)
 		return -1;
-	if (pLDA->N)
-		free(pLDA->N);
-	if (pLDA->S[0])
-		free(pLDA->S[0]);
-	if (pLDA->S)
-		free(pLDA->S);
-	if (pLDA->C[0])
-		free(pLDA->C[0]);
-	if (pLDA->C)
-		free(pLDA->C);
-	if (pLDA->mean)
-		free(pLDA->mean);
+	if (pLDA->pAsync){
+		LDA_SolveWait(hLDA);
+		if (pLDA->pAsync->current)
+			LDA_ModelRelease(pLDA->pAsync->current);
+		delete pLDA->pAsync;
+	}
+	acc_release(pLDA->acc);
+	acc_release(pLDA->base);
+	acc_release(pLDA->spare);
+	acc_release(pLDA->closed);
+	if (pLDA->ring){
+		for (i = 0; i < pLDA->nRing; i++)
+			acc_release(pLDA->ring[i]);
+		free(pLDA->ring);
+	}
+	if (pLDA->shift)
+		free(pLDA->shift);
+	if (pLDA->bShift)
+		free(pLDA->bShift);
+	if (pLDA->work)
+		free(pLDA->work);
+	if (pLDA->cls)
+		free(pLDA->cls);
+	if (pLDA->lock)
+		delete pLDA->lock;
+	if (pLDA->baseLock)
+		delete pLDA->baseLock;
+	if (pLDA->subLock)
+		delete pLDA->subLock;
+	if (pLDA->solLock)
+		delete pLDA->solLock;
+	if (pLDA->subSw)
+		free(pLDA->subSw);
+	if (pLDA->subB)
+		free(pLDA->subB);
+	sol_free(&pLDA->sol);
+	qda_free(&pLDA->qda);
     free(pLDA);
 	return 0;
 }
 
+// Weight of the next sample, advancing the decay clock. Called with the
+// lock held.
+static double lda_weight(LDA *pLDA)
+{
+	if (pLDA->rate == 0)
+		return 1;
+	pLDA->t += pLDA->rate;
+	return exp2(pLDA->t - pLDA->acc->t0);
+}
+
+static void lda_advance(LDA *pLDA);
+static INT lda_room(LDA *pLDA);
+
+// Shift of class k, taken from the sample v (or vf) if the class has none
+// yet. Called with the lock held.
+static double *lda_shift(LDA *pLDA, INT k, const double *v, const float *vf)
+{
+	double *K = pLDA->shift + k * pLDA->d;
+	INT i;
+
+	if (!pLDA->bShift[k]){
+		for (i = 0; i < pLDA->d; i++)
+			K[i] = v ? v[i] : vf[i];
+		pLDA->bShift[k] = TRUE;
+	}
+	return K;
+}
+
 INT LDA_Add(HANDLE hLDA, double *v, INT k)
 {
 	LDA *pLDA = (LDA *)hLDA;
+	ACCUM *pAcc;
     INT d, q;
 	INT i, j;
+	double w, wy;
+	double *y, *K;
+	LDAPERFMARK mark;
 
 	if (pLDA == NULL)
 		return -1;
-	if (pLDA->bTrained)
-		return -1;
 
 	d = pLDA->d;
 	q = pLDA->q;
 	if (k >= q)
 		return -1;
 
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	if (pLDA->bTrained)
+		return -1;
+
+	lda_perf_begin(&mark);
+	pAcc = pLDA->acc;
+	w = lda_weight(pLDA);
+	y = pLDA->work;
+	K = lda_shift(pLDA, k, v, NULL);
+	for (i = 0; i < d; i++)
+		y[i] = v[i] - K[i];
 	for (i = 0; i < d; i++){
-        pLDA->mean[i] += v[i];
-		pLDA->C[k][i] += v[i];
+		wy = w * y[i];
+		pAcc->C[k][i] += wy;
         for(j = i; j < d; j++)
-            pLDA->S[k][j + i*d] += v[i]*v[j];
+            pAcc->S[k][j + i*d] += wy*y[j];
     }
-	pLDA->N[k]++;
+	pAcc->N[k] += w;
+	pAcc->count++;
     pLDA->count++;
+	lda_advance(pLDA);
+	lda_perf_end(&mark, LDA_PERF_ADD);
 	return pLDA->count;
 }
 
-INT LDA_Solve(HANDLE hLDA, double *eigenvector, double *eigenvalue)
+// Shifts the n (<= LDA_BLOCK) rows of a block into y and adds their
+// weights (w) to C and N; cls receives the classes present. Rows come as
+// doubles (v) or floats (vf) and are shifted in double; mult, if not NULL,
+// holds per-row multiplicities. Called with the lock held. Returns the
+// number of classes in cls.
+static INT lda_block_prep(LDA *pLDA, const double *v, const float *vf, const INT *k, const double *mult, INT n,
+	double *y, double *w, INT *cls)
+{
+	ACCUM *pAcc = pLDA->acc;
+	INT d = pAcc->d;
+	INT i, j, r, c, nc;
+	double *yr, *K;
+
+	nc = 0;
+	for (r = 0; r < n; r++){
+		c = k[r];
+		w[r] = lda_weight(pLDA);
+		if (mult)
+			w[r] *= mult[r];
+		yr = y + r * d;
+		if (v){
+			K = lda_shift(pLDA, c, v + (INT64)r * d, NULL);
+			for (i = 0; i < d; i++)
+				yr[i] = v[(INT64)r * d + i] - K[i];
+		}
+		else {
+			K = lda_shift(pLDA, c, NULL, vf + (INT64)r * d);
+			for (i = 0; i < d; i++)
+				yr[i] = vf[(INT64)r * d + i] - K[i];
+		}
+		for (i = 0; i < d; i++)
+			pAcc->C[c][i] += w[r] * yr[i];
+		for (j = 0; j < nc && cls[j] != c; j++)
+			;
+		if (j == nc)
+			cls[nc++] = c;
+		pAcc->N[c] += w[r];
+	}
+
+	return nc;
+}
+
+// Rows i0..i1-1 of S for a prepared block. Rows are applied row-of-S at a
+// time: one row of every class matrix is reused for the whole block
+// instead of streaming all of S[k] per sample, and the block's products
+// are summed in P (q*d) before they are added to S, so S grows by block
+// sums rather than single products. Every element of S sees the same
+// operations in the same order whichever i range it falls in.
+static void lda_block_rows(ACCUM *pAcc, const double *y, const double *w, const INT *k, INT n,
+	const INT *cls, INT nc, double *P, INT i0, INT i1)
+{
+	const LDAKERNEL *K = lda_kernel();
+	INT d = pAcc->d;
+	INT i, r, c;
+	const double *yr;
+
+	for (i = i0; i < i1; i++){
+		for (c = 0; c < nc; c++)
+			memset(P + cls[c] * d + i, 0, sizeof(double) * (d - i));
+		for (r = 0; r < n; r++){
+			yr = y + r * d;
+			K->axpy(d - i, w[r] * yr[i], yr + i, P + k[r] * d + i);
+		}
+		for (c = 0; c < nc; c++)
+			K->add(d - i, P + cls[c] * d + i, pAcc->S[cls[c]] + i * d + i);
+	}
+}
+
+// Called with the lock held; n <= LDA_BLOCK never crosses a window block
+// boundary.
+static void lda_add_block(LDA *pLDA, const double *v, const float *vf, const INT *k, const double *mult, INT n)
+{
+	INT d = pLDA->d;
+	INT nc;
+	double w[LDA_BLOCK];
+
+	nc = lda_block_prep(pLDA, v, vf, k, mult, n, pLDA->work, w, pLDA->cls);
+	lda_block_rows(pLDA->acc, pLDA->work, w, k, n, pLDA->cls, nc, pLDA->work + LDA_BLOCK * d, 0, d);
+
+	pLDA->acc->count += n;
+	pLDA->count += n;
+	lda_advance(pLDA);
+}
+
+// Parallel ingestion of up to LDA_PAR_BLOCKS prepared blocks. Threads own
+// ranges of rows of S rather than ranges of samples: a thread claims
+// LDA_PAR_ROWS rows and applies every block to them in order, so each
+// element is summed exactly as lda_add_block sums it. Nothing is reduced
+// across threads, and the result is bit-identical to the serial one for
+// any thread count or schedule.
+typedef struct ADDJOB {
+	ACCUM *pAcc;
+	const double *Y;	// nBlock*LDA_BLOCK*d shifted rows
+	const double *W;	// nBlock*LDA_BLOCK weights
+	const INT *k;		// labels of the first block, the rest follow
+	const INT *cls;		// nBlock*q
+	const INT *nc;
+	const INT *rows;	// rows per block
+	INT nBlock;
+	double *P;			// q*d per thread
+	std::atomic<INT> next;
+
+	// The workers live for one lda_add_rows call. The caller prepares a
+	// round of blocks, bumps round and works on it as thread 0; busy
+	// counts the threads still inside the round. round -1 ends the call.
+	std::mutex lock;
+	std::condition_variable cv;
+	INT round;
+	INT busy;
+} ADDJOB;
+
+// Rows of S claimed by thread t in the current round
+static void add_range(ADDJOB *pJob, INT t)
+{
+	ACCUM *pAcc = pJob->pAcc;
+	INT d = pAcc->d;
+	INT q = pAcc->q;
+	double *P = pJob->P + (INT64)t * q * d;
+	INT i0, b, r0;
+
+	while ((i0 = pJob->next.fetch_add(LDA_PAR_ROWS)) < d){
+		for (b = 0, r0 = 0; b < pJob->nBlock; r0 += pJob->rows[b], b++)
+			lda_block_rows(pAcc, pJob->Y + (INT64)b * LDA_BLOCK * d, pJob->W + b * LDA_BLOCK, pJob->k + r0,
+				pJob->rows[b], pJob->cls + b * q, pJob->nc[b], P, i0, MIN(d, i0 + LDA_PAR_ROWS));
+	}
+}
+
+static void add_worker(ADDJOB *pJob, INT t)
+{
+	INT round = 0;
+
+	for (;;){
+		{
+			std::unique_lock<std::mutex> lk(pJob->lock);
+			while (pJob->round == round)
+				pJob->cv.wait(lk);
+			round = pJob->round;
+			if (round < 0)
+				return;
+		}
+		add_range(pJob, t);
+		{
+			std::lock_guard<std::mutex> lk(pJob->lock);
+			if (--pJob->busy == 0)
+				pJob->cv.notify_all();
+		}
+	}
+}
+
+// Adds n rows, on pLDA->nThread threads when the handle neither decays
+// nor windows (lda_advance then has nothing to do between blocks) and the
+// scratch can be had; serially otherwise. Called with the lock held.
+static void lda_add_rows(LDA *pLDA, const double *v, const float *vf, const INT *k, const double *mult, INT n)
+{
+	ADDJOB job;
+	std::thread *worker = NULL;
+	double *Y = NULL;
+	double *W = NULL;
+	double *P = NULL;
+	INT *cls = NULL;
+	INT nc[LDA_PAR_BLOCKS], rows[LDA_PAR_BLOCKS];
+	INT d = pLDA->d;
+	INT q = pLDA->q;
+	INT r, r0, nb, b, i, nThread;
+	LDAPERFMARK mark;
+
+	lda_perf_begin(&mark);
+	nThread = pLDA->nThread;
+	if (nThread > 1 && pLDA->rate == 0 && pLDA->block == 0 && n > LDA_BLOCK){
+		Y = (double *)malloc(sizeof(double) * LDA_PAR_BLOCKS * LDA_BLOCK * d);
+		W = (double *)malloc(sizeof(double) * LDA_PAR_BLOCKS * LDA_BLOCK);
+		P = (double *)malloc(sizeof(double) * nThread * q * d);
+		cls = (INT *)malloc(sizeof(INT) * LDA_PAR_BLOCKS * q);
+	}
+	if (Y == NULL || W == NULL || P == NULL || cls == NULL){
+		for (r = 0; r < n; r += nb){
+			nb = MIN(lda_room(pLDA), n - r);
+			lda_add_block(pLDA, v ? v + (INT64)r * d : NULL, vf ? vf + (INT64)r * d : NULL, k + r,
+				mult ? mult + r : NULL, nb);
+		}
+		goto L_EXIT;
+	}
+
+	job.Y = Y;
+	job.W = W;
+	job.P = P;
+	job.cls = cls;
+	job.nc = nc;
+	job.rows = rows;
+	job.round = 0;
+	job.busy = 0;
+	worker = new std::thread [nThread - 1];
+	for (i = 1; i < nThread; i++)
+		worker[i - 1] = std::thread(add_worker, &job, i);
+
+	for (r0 = 0; r0 < n; r0 = r){
+		// the same blocks lda_add_block would see
+		for (b = 0, r = r0; b < LDA_PAR_BLOCKS && r < n; b++, r += nb){
+			nb = MIN(LDA_BLOCK, n - r);
+			rows[b] = nb;
+			nc[b] = lda_block_prep(pLDA, v ? v + (INT64)r * d : NULL, vf ? vf + (INT64)r * d : NULL, k + r,
+				mult ? mult + r : NULL, nb, Y + (INT64)b * LDA_BLOCK * d, W + b * LDA_BLOCK, cls + b * q);
+		}
+
+		{
+			std::lock_guard<std::mutex> lk(job.lock);
+			job.pAcc = pLDA->acc;
+			job.k = k + r0;
+			job.nBlock = b;
+			job.next = 0;
+			job.busy = nThread;
+			job.round++;
+			job.cv.notify_all();
+		}
+		add_range(&job, 0);
+		{
+			std::unique_lock<std::mutex> lk(job.lock);
+			if (--job.busy == 0)
+				job.cv.notify_all();
+			while (job.busy > 0)
+				job.cv.wait(lk);
+		}
+
+		pLDA->acc->count += r - r0;
+		pLDA->count += r - r0;
+		lda_advance(pLDA);
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(job.lock);
+		job.round = -1;
+		job.cv.notify_all();
+	}
+	for (i = 1; i < nThread; i++)
+		worker[i - 1].join();
+
+L_EXIT:
+
+	if (worker)
+		delete [] worker;
+	if (Y)
+		free(Y);
+	if (W)
+		free(W);
+	if (P)
+		free(P);
+	if (cls)
+		free(cls);
+	lda_perf_end(&mark, LDA_PERF_ADD);
+}
+
+// Rows the open block takes before lda_advance closes it
+static INT lda_room(LDA *pLDA)
+{
+	if (pLDA->block == 0)
+		return LDA_BLOCK;
+	return MIN(LDA_BLOCK, pLDA->block - pLDA->acc->count);
+}
+
+// Keeps the open accumulator in range: renormalizes a decaying one long
+// before 2^(t - t0) can overflow, and closes a full window block, which
+// replaces the oldest one in the ring. Both are O(q*d*d) once per many
+// samples.
+static void lda_advance(LDA *pLDA)
+{
+	ACCUM *pAcc = pLDA->acc;
+	ACCUM *old;
+
+	if (pLDA->rate != 0 && pLDA->t - pAcc->t0 > 512)
+		acc_rescale(pAcc, pLDA->t);
+
+	if (pLDA->block == 0 || pAcc->count < pLDA->block)
+		return;
+
+	old = pLDA->ring[pLDA->head];
+	acc_merge(pLDA->closed, pAcc, 1);
+	acc_merge(pLDA->closed, old, -1);
+	acc_clear(old, 0);
+	pLDA->ring[pLDA->head] = pAcc;
+	pLDA->acc = old;
+	pLDA->head = (pLDA->head + 1) % pLDA->nRing;
+}
+
+INT LDA_AddBatch(HANDLE hLDA, const double *v, const INT *k, INT n)
 {
 	LDA *pLDA = (LDA *)hLDA;
-	INT d, q;
-    INT i, j, k;
-	double *Sw = NULL;
-	double *Sb = NULL;
-	double *t_n = NULL;
-	double *t_n_n = NULL;
+	INT r;
 
-	if (pLDA == NULL)
+	if (pLDA == NULL || v == NULL || k == NULL || n < 0)
+		return -1;
+
+	for (r = 0; r < n; r++){
+		if (k[r] < 0 || k[r] >= pLDA->q)
+			return -1;
+	}
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	if (pLDA->bTrained)
+		return -1;
+
+	lda_add_rows(pLDA, v, NULL, k, NULL, n);
+	return pLDA->count;
+}
+
+INT LDA_AddBatchF(HANDLE hLDA, const float *v, const INT *k, INT n)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	INT r;
+
+	if (pLDA == NULL || v == NULL || k == NULL || n < 0)
+		return -1;
+
+	for (r = 0; r < n; r++){
+		if (k[r] < 0 || k[r] >= pLDA->q)
+			return -1;
+	}
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	if (pLDA->bTrained)
+		return -1;
+
+	// float rows are widened while they are shifted, so the shifted sums
+	// keep the full double precision of the accumulator
+	lda_add_rows(pLDA, NULL, v, k, NULL, n);
+	return pLDA->count;
+}
+
+// Rows with a multiplicity each, e.g. deduplicated samples. A row of
+// weight w counts as w identical samples and as one row.
+INT LDA_AddWeighted(HANDLE hLDA, const double *v, const INT *k, const double *weight, INT n)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	INT r;
+
+	if (pLDA == NULL || v == NULL || k == NULL || weight == NULL || n < 0)
 		return -1;
+
+	for (r = 0; r < n; r++){
+		if (k[r] < 0 || k[r] >= pLDA->q || !(weight[r] >= 0 && weight[r] < HUGE_VAL))
+			return -1;
+	}
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
 	if (pLDA->bTrained)
 		return -1;
 
+	lda_add_rows(pLDA, v, NULL, k, weight, n);
+	return pLDA->count;
+}
+
+// Sufficient statistics of class k computed elsewhere: the count n, the
+// sum of the samples (d) and the sum of their outer products, either the
+// full symmetric d*d matrix or its upper triangle packed by rows
+// (d*(d+1)/2, row i holding columns i..d-1). Costs O(d*d) whatever n is.
+// On a decaying handle the block enters as n samples arriving now.
+INT LDA_AddMoments(HANDLE hLDA, INT k, double n, const double *sum, const double *sxx, INT layout)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	ACCUM *pAcc;
+	const double *row;
+	double *s, *K;
+	double w, c;
+	INT d, i, j;
+
+	if (pLDA == NULL || sum == NULL || sxx == NULL)
+		return -1;
+	if (k < 0 || k >= pLDA->q || !(n > 0 && n < HUGE_VAL))
+		return -1;
+	if (layout != LDA_PACKED && layout != LDA_FULL)
+		return -1;
+
 	d = pLDA->d;
-	q = pLDA->q;
-	pLDA->bTrained = TRUE;
 
-	for (j = 0; j < d; j++)
-		pLDA->mean[j] /= pLDA->count;
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	if (pLDA->bTrained)
+		return -1;
 
-	Sw = (double *)calloc(d * d, sizeof(double));
-	Sb = (double *)calloc(d * d, sizeof(double));
-	t_n = (double *)calloc(d, sizeof(double));
-	t_n_n = (double *)calloc(d * d, sizeof(double));
-	if (Sw == NULL || Sb == NULL || t_n == NULL || t_n_n == NULL)
-		goto L_ERROR;
+	pAcc = pLDA->acc;
+	w = 1;
+	if (pLDA->rate != 0){
+		// a large block can jump t far past t0; renormalize first, as
+		// lda_advance does, so that its weight stays finite
+		pLDA->t += pLDA->rate * n;
+		if (pLDA->t - pAcc->t0 > 512)
+			acc_rescale(pAcc, pLDA->t);
+		w = exp2(pLDA->t - pAcc->t0);
+	}
 
-	for (k = 0; k < q; k++){
-		for (j = 0; j < d; j++){
-			pLDA->C[k][j] /= pLDA->N[k];
-			t_n[j] = pLDA->C[k][j] - pLDA->mean[j];
-			for (i = 0; i <= j; i++){
-				pLDA->S[k][j + i*d] -= (pLDA->C[k][i] * pLDA->C[k][j]) * pLDA->N[k];
-				pLDA->S[k][i + j*d] = pLDA->S[k][j + i*d];
-			}
+	// a class first seen here is shifted by its mean
+	K = pLDA->shift + k * d;
+	if (!pLDA->bShift[k]){
+		for (i = 0; i < d; i++)
+			K[i] = sum[i] / n;
+		pLDA->bShift[k] = TRUE;
+	}
+
+	// sum((x-K)(x-K)') = sxx - K*sum' - sum*K' + n*K*K'
+	row = sxx;
+	for (i = 0; i < d; i++){
+		pAcc->C[k][i] += w * (sum[i] - n * K[i]);
+		s = pAcc->S[k] + i * d;
+		if (layout == LDA_FULL)
+			row = sxx + i * d + i;
+		for (j = i; j < d; j++){
+			c = row[j - i] - K[i] * sum[j] - sum[i] * K[j] + n * K[i] * K[j];
+			s[j] += w * c;
 		}
-		mat_add(Sw, pLDA->S[k], d, d, Sw);
-		mat_mul(t_n, d, 1, t_n, 1, d, t_n_n);
-		mat_scal(t_n_n, d, d, pLDA->N[k], t_n_n);
-		mat_add(Sb, t_n_n, d, d, Sb);
+		if (layout == LDA_PACKED)
+			row += d - i;
 	}
+	pAcc->N[k] += w * n;
 
-	// eigenvector & eigenvalue
-	if (GeneralizedEigenvalueDecomposition(d, Sb, Sw, eigenvector, eigenvalue, NULL) != 0)
-		goto L_ERROR;
+	// whole samples for the window and the handle's sample count, which
+	// saturates rather than wrap; n itself may be any finite weight
+	j = 0x7fffffff - pLDA->count;
+	if (n + 0.5 < j)
+		j = MAX(1, (INT)(n + 0.5));
+	pAcc->count += j;
+	pLDA->count += j;
+	lda_advance(pLDA);
 
-	free(Sw);
-	free(Sb);
-	free(t_n);
-	free(t_n_n);
+	return pLDA->count;
+}
 
-    return 0;
+INT LDA_GetInfo(HANDLE hLDA, INT *d, INT *q)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	if (pLDA == NULL)
+		return -1;
+	if (d)
+		*d = pLDA->d;
+	if (q)
+		*q = pLDA->q;
+	return 0;
+}
 
-L_ERROR:
+// Exponential forgetting: the weight of a sample halves every halfLife
+// later samples, applied lazily so a sample still costs one update of
+// S[k]. 0 keeps every sample. Must be set before the first sample.
+INT LDA_SetDecay(HANDLE hLDA, double halfLife)
+{
+	LDA *pLDA = (LDA *)hLDA;
 
-	if (Sw)
-		free(Sw);
+	if (pLDA == NULL || !(halfLife == 0 || halfLife >= 1))
+		return -1;
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	if (pLDA->count != 0 || pLDA->block != 0)
+		return -1;
+	pLDA->rate = (halfLife == 0) ? 0 : 1.0 / halfLife;
+	return 0;
+}
+
+// Sliding window over the last window samples, kept as blocks of
+// window/blocks samples: the model covers the open block and the
+// blocks-1 closed ones before it, and the oldest block drops out as a new
+// one closes. Must be set before the first sample; such a handle has no
+// background solve.
+INT LDA_SetWindow(HANDLE hLDA, INT window, INT blocks)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	ACCUM **ring = NULL;
+	ACCUM *closed = NULL;
+	INT i, n;
+
+	if (pLDA == NULL || blocks < 2 || window < blocks)
+		return -1;
+
+	n = blocks - 1;
+	ring = (ACCUM **)calloc(n, sizeof(ACCUM *));
+	closed = acc_create(pLDA->d, pLDA->q);
+	if (ring == NULL || closed == NULL)
+		goto L_ERROR;
+	for (i = 0; i < n; i++){
+		ring[i] = acc_create(pLDA->d, pLDA->q);
+		if (ring[i] == NULL)
+			goto L_ERROR;
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(*pLDA->lock);
+		if (pLDA->count != 0 || pLDA->rate != 0 || pLDA->block != 0)
+			goto L_ERROR;
+		pLDA->ring = ring;
+		pLDA->nRing = n;
+		pLDA->head = 0;
+		pLDA->closed = closed;
+		pLDA->block = (window + blocks - 1) / blocks;
+	}
+
+	return 0;
+
+L_ERROR:
+
+	if (ring){
+		for (i = 0; i < n; i++)
+			acc_release(ring[i]);
+		free(ring);
+	}
+	acc_release(closed);
+
+	return -1;
+}
+
+// Threads for LDA_AddBatch, LDA_AddBatchF and LDA_AddWeighted (1, the
+// default, keeps ingestion on the caller's thread; 0 takes one per
+// core). Each element of S is still summed by one thread in sample order,
+// so the sums are bit-identical to the serial ones whatever the count.
+// Decaying and windowed handles ingest serially.
+INT LDA_SetThreads(HANDLE hLDA, INT nThread)
+{
+	LDA *pLDA = (LDA *)hLDA;
+
+	if (pLDA == NULL || nThread < 0)
+		return -1;
+	if (nThread == 0)
+		nThread = MAX(1, (INT)std::thread::hardware_concurrency());
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	pLDA->nThread = nThread;
+	return 0;
+}
+
+int lda_project(const double *w, int ldw, int d, int k, const double *v, int n, double *u);
+
+// Scales every eigenvector to unit pooled within-class variance, so that
+// Euclidean distance in the projected space is the Mahalanobis distance,
+// and projects the class means once for LDA_Classify.
+static void lda_classifier(SOLUTION *pSol, INT d, INT q, const double *Sw, double *t)
+{
+	double total = 0;
+	double dof, s;
+	INT i, j, k;
+
+	for (k = 0; k < q; k++)
+		total += pSol->Nk[k];
+	dof = (total > q) ? total - q : total;
+
+	for (i = 0; i < d; i++){
+		// t = Sw * w_i
+		for (j = 0; j < d; j++){
+			t[j] = 0;
+			for (k = 0; k < d; k++)
+				t[j] += Sw[j*d + k] * pSol->W[k*d + i];
+		}
+		s = 0;
+		for (j = 0; j < d; j++)
+			s += pSol->W[j*d + i] * t[j];
+		s /= dof;
+		pSol->scale[i] = (s > 0) ? 1.0 / sqrt(s) : 0;
+	}
+
+	pSol->kc = MAX(1, MIN(q - 1, d));
+	lda_project(pSol->W, d, d, pSol->kc, pSol->M, q, pSol->centroid);
+	for (k = 0; k < q; k++){
+		for (i = 0; i < pSol->kc; i++)
+			pSol->centroid[k*pSol->kc + i] *= pSol->scale[i];
+		pSol->logPrior[k] = (pSol->Nk[k] > 0) ? log(pSol->Nk[k] / total) : -HUGE_VAL;
+	}
+}
+
+#define LDA_MAXPART	4
+
+// Scatter of class k around its own mean, from the sum of nPart
+// accumulators weighted by f, into the upper triangle of S (d*d):
+//   S = S[k] - c*c'*N[k],  c = C[k]/N[k],  m = K[k] + c
+// m receives the class mean (zero for an empty class, whose S is left
+// alone). Returns the class weight. t_n is d scratch.
+static double lda_class(ACCUM **part, INT nPart, const double *f, const double *shift, INT k,
+	double *S, double *m, double *t_n)
+{
+	INT d = part[0]->d;
+	INT i, j, p;
+	double n, sum;
+
+	n = 0;
+	for (p = 0; p < nPart; p++)
+		n += f[p] * part[p]->N[k];
+	if (n == 0){
+		memset(m, 0, sizeof(double) * d);
+		return 0;
+	}
+	for (j = 0; j < d; j++){
+		t_n[j] = 0;
+		for (p = 0; p < nPart; p++)
+			t_n[j] += f[p] * part[p]->C[k][j];
+		t_n[j] /= n;
+		m[j] = shift[k*d + j] + t_n[j];
+	}
+	for (i = 0; i < d; i++){
+		for (j = i; j < d; j++){
+			sum = 0;
+			for (p = 0; p < nPart; p++)
+				sum += f[p] * part[p]->S[k][j + i*d];
+			S[j + i*d] = sum - (t_n[i] * t_n[j]) * n;
+		}
+	}
+
+	return n;
+}
+
+// Builds Sw and Sb (d*d), the class means M (q*d) and the class counts Nk
+// from the sum of nPart accumulators, as weighted at time t, without
+// modifying them. Called with the accumulators locked; t_n_n is d*d
+// scratch.
+static void lda_scatter(ACCUM **part, INT nPart, double t, const double *shift, double *Sw, double *Sb,
+	double *M, double *Nk, double *t_n, double *t_n_n)
+{
+	INT d = part[0]->d;
+	INT q = part[0]->q;
+	INT i, j, k, p;
+	double *mu;
+	double n, total;
+	double f[LDA_MAXPART];
+
+	memset(Sw, 0, sizeof(double) * d * d);
+	memset(Sb, 0, sizeof(double) * d * d);
+
+	for (p = 0; p < nPart; p++)
+		f[p] = exp2(part[p]->t0 - t);
+
+	// within-class scatter, the sum of the class scatters
+	total = 0;
+	for (k = 0; k < q; k++){
+		n = lda_class(part, nPart, f, shift, k, t_n_n, M + k * d, t_n);
+		Nk[k] = n;
+		total += n;
+		if (n == 0)
+			continue;
+		for (i = 0; i < d; i++){
+			for (j = i; j < d; j++)
+				Sw[j + i*d] += t_n_n[j + i*d];
+		}
+	}
+
+	for (i = 0; i < d; i++){
+		for (j = 0; j < i; j++)
+			Sw[j + i*d] = Sw[i + j*d];
+	}
+
+	// between-class scatter around the overall mean
+	mu = t_n_n;
+	memset(mu, 0, sizeof(double) * d);
+	for (k = 0; k < q; k++){
+		for (j = 0; j < d; j++)
+			mu[j] += Nk[k] * M[k*d + j];
+	}
+	for (j = 0; j < d; j++)
+		mu[j] /= total;
+
+	for (k = 0; k < q; k++){
+		n = Nk[k];
+		if (n == 0)
+			continue;
+		for (j = 0; j < d; j++)
+			t_n[j] = M[k*d + j] - mu[j];
+		for (i = 0; i < d; i++){
+			for (j = 0; j < d; j++)
+				Sb[j + i*d] += (t_n[i] * t_n[j]) * n;
+		}
+	}
+}
+
+static double lda_seconds(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Eigendecomposition and classifier tables of a solution whose M, Nk and
+// nSolved are already set. Sb is overwritten. pStats, if not NULL, receives
+// the QZ diagnostics and classifier time.
+static INT lda_eigen(SOLUTION *pSol, INT d, INT q, double *Sw, double *Sb, double *t, LDA_STATS *pStats)
+{
+	double t0;
+
+	if (GeneralizedEigenvalueDecompositionStats(d, Sb, Sw, pSol->W, pSol->lambda, NULL, pStats) != 0)
+		return -1;
+	t0 = lda_seconds();
+	lda_classifier(pSol, d, q, Sw, t);
+	if (pStats)
+		pStats->tClassifier = lda_seconds() - t0;
+	return 0;
+}
+
+// q*k class means in the scaled space of the leading k eigenvectors
+static void lda_centroid(const SOLUTION *pSol, INT d, INT q, INT k, double *centroid)
+{
+	INT i, j;
+
+	lda_project(pSol->W, d, d, k, pSol->M, q, centroid);
+	for (i = 0; i < q; i++){
+		for (j = 0; j < k; j++)
+			centroid[i*k + j] *= pSol->scale[j];
+	}
+}
+
+// Wraps a solution into a model handle and makes it the one returned by
+// LDA_AcquireModel, unless a solve over more samples got there first.
+// Returns the publisher's reference, which the caller releases.
+static HANDLE lda_publish(LDA *pLDA, const SOLUTION *pSol)
+{
+	ASYNC *pAsync = pLDA->pAsync;
+	HANDLE hModel, hOld;
+	double *centroid;
+	INT d = pLDA->d;
+	INT q = pLDA->q;
+
+	centroid = (double *)malloc(sizeof(double) * q * d);
+	if (centroid == NULL)
+		return NULL;
+	lda_centroid(pSol, d, q, d, centroid);
+	hModel = LDA_ModelCreate(d, d, q, pSol->W, pSol->lambda, pSol->M, pSol->Nk, pSol->scale, centroid);
+	free(centroid);
+	if (hModel == NULL)
+		return NULL;
+
+	{
+		std::lock_guard<std::mutex> lk(pAsync->pubLock);
+		if (pAsync->current != NULL && pSol->nSolved < pAsync->published)
+			return hModel;
+		LDA_ModelRetain(hModel);
+		hOld = pAsync->current;
+		pAsync->current = hModel;
+		pAsync->published = pSol->nSolved;
+	}
+
+	// readers that took hOld hold references of their own
+	if (hOld)
+		LDA_ModelRelease(hOld);
+
+	return hModel;
+}
+
+// Makes the solution in *pSol the handle's, hands back the one it
+// replaces in *pSol and publishes the new one if anyone reads models.
+// A first LDA_AcquireModel that runs before the exchange still sees
+// the new solution published, since it sets bPublish under solLock.
+static void lda_install(LDA *pLDA, SOLUTION *pSol)
+{
+	ASYNC *pAsync = pLDA->pAsync;
+	HANDLE hModel = NULL;
+	BOOL bPublish;
+
+	bPublish = pAsync->bPublish.load();
+	if (bPublish)
+		hModel = lda_publish(pLDA, pSol);
+	{
+		std::lock_guard<std::mutex> lk(*pLDA->solLock);
+		SOLUTION old = pLDA->sol;
+		pLDA->sol = *pSol;
+		*pSol = old;
+		if (!bPublish && pAsync->bPublish.load())
+			hModel = lda_publish(pLDA, &pLDA->sol);
+	}
+	if (hModel)
+		LDA_ModelRelease(hModel);
+}
+
+// The accumulators that make up the running sums; called with both locks
+// held.
+static INT lda_parts(LDA *pLDA, ACCUM **part)
+{
+	INT nPart = 0;
+
+	part[nPart++] = pLDA->base;
+	part[nPart++] = pLDA->acc;
+	if (pLDA->frozen)
+		part[nPart++] = pLDA->frozen;
+	if (pLDA->closed)
+		part[nPart++] = pLDA->closed;
+	return nPart;
+}
+
+// Reduces all epochs to Sw/Sb and the class means and counts of pSol.
+// Only this O(q*d*d) step holds the locks.
+static INT lda_gather(LDA *pLDA, SOLUTION *pSol, double *Sw, double *Sb, double *t_n, double *t_n_n, BOOL bFreeze)
+{
+	ACCUM *part[LDA_MAXPART];
+	INT nPart;
+
+	std::lock_guard<std::mutex> lkBase(*pLDA->baseLock);
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	if ((bFreeze && pLDA->bTrained) || pLDA->count == 0)
+		return -1;
+	nPart = lda_parts(pLDA, part);
+	lda_scatter(part, nPart, pLDA->t, pLDA->shift, Sw, Sb, pSol->M, pSol->Nk, t_n, t_n_n);
+	pSol->nSolved = pLDA->count;
+	if (bFreeze)
+		pLDA->bTrained = TRUE;
+	return 0;
+}
+
+// Solves from a consistent view of the running sums. bFreeze marks the
+// handle trained, after which LDA_Add and LDA_Solve are rejected;
+// otherwise ingestion continues and only the stored solution is replaced.
+static INT lda_solve(LDA *pLDA, double *eigenvector, double *eigenvalue, BOOL bFreeze)
+{
+	INT d, q;
+	double *Sw = NULL;
+	double *Sb = NULL;
+	double *t_n = NULL;
+	double *t_n_n = NULL;
+	SOLUTION sol;
+	LDA_STATS stats;
+	LDAPERFMARK mark;
+	double t0;
+	INT r;
+
+	d = pLDA->d;
+	q = pLDA->q;
+	memset(&sol, 0, sizeof(sol));
+
+	// a background solve still owns the epoch it is merging into base
+	if (bFreeze)
+		LDA_SolveWait(pLDA);
+
+	Sw = (double *)calloc(d * d, sizeof(double));
+	Sb = (double *)calloc(d * d, sizeof(double));
+	t_n = (double *)calloc(d, sizeof(double));
+	t_n_n = (double *)calloc(d * d, sizeof(double));
+	if (Sw == NULL || Sb == NULL || t_n == NULL || t_n_n == NULL)
+		goto L_ERROR;
+
+	// solved aside, the handle keeps its last good solution on failure
+	if (sol_alloc(&sol, d, q) != 0)
+		goto L_ERROR;
+
+	memset(&stats, 0, sizeof(stats));
+	t0 = lda_seconds();
+	lda_perf_begin(&mark);
+	r = lda_gather(pLDA, &sol, Sw, Sb, t_n, t_n_n, bFreeze);
+	lda_perf_end(&mark, LDA_PERF_GATHER);
+	if (r != 0)
+		goto L_ERROR;
+	stats.tGather = lda_seconds() - t0;
+
+	// eigenvector & eigenvalue, kept for LDA_SaveModel; the stats are
+	// published either way so a failed solve can be diagnosed
+	r = lda_eigen(&sol, d, q, Sw, Sb, t_n, &stats);
+	stats.tTotal = lda_seconds() - t0;
+	{
+		std::lock_guard<std::mutex> lk(*pLDA->lock);
+		pLDA->stats = stats;
+	}
+	if (r != 0)
+		goto L_ERROR;
+	if (eigenvector)
+		memcpy(eigenvector, sol.W, sizeof(double) * d * d);
+	if (eigenvalue)
+		memcpy(eigenvalue, sol.lambda, sizeof(double) * d);
+
+	// the previous solution comes back in sol
+	lda_install(pLDA, &sol);
+	sol_free(&sol);
+
+	free(Sw);
+	free(Sb);
+	free(t_n);
+	free(t_n_n);
+
+    return 0;
+
+L_ERROR:
+
+	sol_free(&sol);
+	if (Sw)
+		free(Sw);
 	if (Sb)
 		free(Sb);
 	if (t_n)
@@ -255,3 +1368,2137 @@ L_ERROR:
 
 	return -1;
 }
+
+INT LDA_Solve(HANDLE hLDA, double *eigenvector, double *eigenvalue)
+{
+	LDA *pLDA = (LDA *)hLDA;
+
+	if (pLDA == NULL)
+		return -1;
+
+	return lda_solve(pLDA, eigenvector, eigenvalue, TRUE);
+}
+
+INT LDA_SolveSnapshot(HANDLE hLDA, double *eigenvector, double *eigenvalue)
+{
+	LDA *pLDA = (LDA *)hLDA;
+
+	if (pLDA == NULL)
+		return -1;
+
+	return lda_solve(pLDA, eigenvector, eigenvalue, FALSE);
+}
+
+INT LDA_SolveStats(HANDLE hLDA, LDA_STATS *stats)
+{
+	LDA *pLDA = (LDA *)hLDA;
+
+	if (pLDA == NULL || stats == NULL)
+		return -1;
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	*stats = pLDA->stats;
+	return 0;
+}
+
+int CholeskyDecomposition(int n, double *a);
+void CholeskyForward(int n, const double *l, int nrhs, double *b, int ldb);
+void CholeskySolve(int n, const double *l, int nrhs, double *b, int ldb);
+
+// Y = S * X and, if G is not NULL, G = X' * Y for a d*d matrix S and a
+// d*k block X
+static void lda_gram(INT d, INT k, const double *S, const double *X, double *Y, double *G)
+{
+	INT i, j, c;
+	const double *si, *xj;
+	double *yi;
+	double t;
+
+	memset(Y, 0, sizeof(double) * d * k);
+	for (i = 0; i < d; i++){
+		si = S + i * d;
+		yi = Y + i * k;
+		for (j = 0; j < d; j++){
+			t = si[j];
+			xj = X + j * k;
+			for (c = 0; c < k; c++)
+				yi[c] += t * xj[c];
+		}
+	}
+
+	if (G == NULL)
+		return;
+	memset(G, 0, sizeof(double) * k * k);
+	for (i = 0; i < d; i++){
+		for (j = 0; j < k; j++){
+			t = X[i*k + j];
+			for (c = 0; c < k; c++)
+				G[j*k + c] += t * Y[i*k + c];
+		}
+	}
+}
+
+// Rayleigh-Ritz: replaces the basis X (d*k) by the Ritz vectors of the
+// k*k pencil (X'*Sb*X, X'*Sw*X), sorted by eigenvalue.
+static INT lda_ritz(INT d, INT k, const double *Sw, const double *Sb, double *X, double *lambda,
+	double *Y, double *A, double *B, double *V)
+{
+	INT i, j, c, best;
+	double t;
+
+	lda_gram(d, k, Sb, X, Y, A);
+	lda_gram(d, k, Sw, X, Y, B);
+	if (GeneralizedEigenvalueDecomposition(k, A, B, V, lambda, NULL) != 0)
+		return -1;
+
+	// order by the eigenvalue itself; a collapsed basis shows up as a
+	// non-finite one
+	for (i = 0; i < k; i++){
+		if (!(fabs(lambda[i]) < HUGE_VAL))
+			return -1;
+		best = i;
+		for (j = i + 1; j < k; j++){
+			if (lambda[j] > lambda[best])
+				best = j;
+		}
+		if (best != i){
+			t = lambda[i]; lambda[i] = lambda[best]; lambda[best] = t;
+			for (c = 0; c < k; c++){
+				t = V[c*k + i]; V[c*k + i] = V[c*k + best]; V[c*k + best] = t;
+			}
+		}
+	}
+
+	// X = X * V
+	for (i = 0; i < d; i++){
+		for (j = 0; j < k; j++){
+			t = 0;
+			for (c = 0; c < k; c++)
+				t += X[i*k + c] * V[c*k + j];
+			Y[i*k + j] = t;
+		}
+	}
+	memcpy(X, Y, sizeof(double) * d * k);
+
+	return 0;
+}
+
+// Refines the leading k discriminants of the last solve against the
+// current sums instead of solving from scratch. Each of the iters steps
+// applies Sw^-1 * Sb to the previous eigenvectors and is followed by a
+// Rayleigh-Ritz step on the k*k pencil; iters = 0 is a plain Rayleigh-Ritz
+// update. residual receives max |Sb*x - l*Sw*x| / (|Sb*x| + |l|*|Sw*x|)
+// over the refined pairs; a large value means the subspace has moved and
+// LDA_SolveSnapshot is warranted. Columns beyond k keep their old values.
+INT LDA_SolveUpdate(HANDLE hLDA, INT k, INT iters, double *eigenvector, double *eigenvalue, double *residual)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	SOLUTION sol;
+	SOLUTION *pSol;
+	INT d, q;
+	INT i, j, c, it;
+	double *Sw = NULL;
+	double *Sb = NULL;
+	double *L = NULL;
+	double *X = NULL;
+	double *Y = NULL;
+	double *A = NULL;
+	double *B = NULL;
+	double *V = NULL;
+	double *lambda = NULL;
+	double *t_n = NULL;
+	double *t_n_n = NULL;
+	double *sx, *wx;
+	double t, r, nb, nw, res;
+
+	if (pLDA == NULL || iters < 0)
+		return -1;
+
+	// refined on a copy, exchanged on success like a full solve
+	d = pLDA->d;
+	q = pLDA->q;
+	memset(&sol, 0, sizeof(sol));
+	if (lda_copy_sol(pLDA, &sol) != 0)
+		return -1;
+	pSol = &sol;
+	if (k <= 0)
+		k = pSol->kc;
+	if (k > MIN(q - 1, d)){
+		sol_free(&sol);
+		return -1;
+	}
+
+	Sw = (double *)calloc(d * d, sizeof(double));
+	Sb = (double *)calloc(d * d, sizeof(double));
+	L = (double *)malloc(sizeof(double) * d * d);
+	X = (double *)malloc(sizeof(double) * d * k);
+	Y = (double *)malloc(sizeof(double) * d * k);
+	A = (double *)malloc(sizeof(double) * k * k);
+	B = (double *)malloc(sizeof(double) * k * k);
+	V = (double *)malloc(sizeof(double) * k * k);
+	lambda = (double *)malloc(sizeof(double) * k);
+	t_n = (double *)calloc(d, sizeof(double));
+	t_n_n = (double *)calloc(d * d, sizeof(double));
+	if (Sw == NULL || Sb == NULL || L == NULL || X == NULL || Y == NULL || A == NULL ||
+		B == NULL || V == NULL || lambda == NULL || t_n == NULL || t_n_n == NULL)
+		goto L_ERROR;
+
+	// the previous solution is the starting subspace
+	for (i = 0; i < d; i++){
+		for (j = 0; j < k; j++)
+			X[i*k + j] = pSol->W[i*d + j];
+	}
+
+	if (lda_gather(pLDA, pSol, Sw, Sb, t_n, t_n_n, FALSE) != 0)
+		goto L_ERROR;
+
+	if (iters > 0){
+		memcpy(L, Sw, sizeof(double) * d * d);
+		if (CholeskyDecomposition(d, L) != 0)
+			goto L_ERROR;
+	}
+	for (it = 0; it < iters; it++){
+		lda_gram(d, k, Sb, X, Y, NULL);
+		CholeskySolve(d, L, k, Y, k);
+		memcpy(X, Y, sizeof(double) * d * k);
+		if (lda_ritz(d, k, Sw, Sb, X, lambda, Y, A, B, V) != 0)
+			goto L_ERROR;
+	}
+	if (iters == 0 && lda_ritz(d, k, Sw, Sb, X, lambda, Y, A, B, V) != 0)
+		goto L_ERROR;
+
+	// same normalization as the full solve (largest component of unit
+	// magnitude), with the sign of the previous vector
+	sx = t_n_n;
+	wx = t_n_n + d;
+	res = 0;
+	for (j = 0; j < k; j++){
+		t = 0;
+		for (i = 0; i < d; i++)
+			t = MAX(t, fabs(X[i*k + j]));
+		r = 0;
+		for (i = 0; i < d; i++)
+			r += X[i*k + j] * pSol->W[i*d + j];
+		if (r < 0)
+			t = -t;
+		for (i = 0; i < d; i++)
+			pSol->W[i*d + j] = (t != 0) ? X[i*k + j] / t : 0;
+		pSol->lambda[j] = lambda[j];
+
+		for (i = 0; i < d; i++){
+			sx[i] = 0;
+			wx[i] = 0;
+			for (c = 0; c < d; c++){
+				sx[i] += Sb[i*d + c] * pSol->W[c*d + j];
+				wx[i] += Sw[i*d + c] * pSol->W[c*d + j];
+			}
+		}
+		r = nb = nw = 0;
+		for (i = 0; i < d; i++){
+			t = sx[i] - lambda[j] * wx[i];
+			r += t * t;
+			nb += sx[i] * sx[i];
+			nw += wx[i] * wx[i];
+		}
+		t = sqrt(nb) + fabs(lambda[j]) * sqrt(nw);
+		if (t > 0)
+			res = MAX(res, sqrt(r) / t);
+	}
+
+	lda_classifier(pSol, d, q, Sw, t_n);
+	if (eigenvector)
+		memcpy(eigenvector, pSol->W, sizeof(double) * d * d);
+	if (eigenvalue)
+		memcpy(eigenvalue, pSol->lambda, sizeof(double) * d);
+	if (residual)
+		*residual = res;
+
+	lda_install(pLDA, &sol);
+	sol_free(&sol);
+
+	free(Sw);
+	free(Sb);
+	free(L);
+	free(X);
+	free(Y);
+	free(A);
+	free(B);
+	free(V);
+	free(lambda);
+	free(t_n);
+	free(t_n_n);
+
+	return 0;
+
+L_ERROR:
+
+	sol_free(&sol);
+	if (Sw)
+		free(Sw);
+	if (Sb)
+		free(Sb);
+	if (L)
+		free(L);
+	if (X)
+		free(X);
+	if (Y)
+		free(Y);
+	if (A)
+		free(A);
+	if (B)
+		free(B);
+	if (V)
+		free(V);
+	if (lambda)
+		free(lambda);
+	if (t_n)
+		free(t_n);
+	if (t_n_n)
+		free(t_n_n);
+
+	return -1;
+}
+
+
+// Background half of LDA_SolveAsync. The frozen epoch is folded into base
+// and goes back to the handle as the next spare before the
+// eigendecomposition starts, so ingestion never waits on the solve.
+static void lda_worker(LDA *pLDA, ACCUM *frozen, double t, LDA_CALLBACK callback, void *user)
+{
+	SOLUTION sol;
+	double *Sw = NULL;
+	double *Sb = NULL;
+	double *t_n = NULL;
+	double *t_n_n = NULL;
+	HANDLE hModel = NULL;
+	INT d = pLDA->d;
+	INT q = pLDA->q;
+	INT status = -1;
+
+	memset(&sol, 0, sizeof(sol));
+
+	Sw = (double *)calloc(d * d, sizeof(double));
+	Sb = (double *)calloc(d * d, sizeof(double));
+	t_n = (double *)calloc(d, sizeof(double));
+	t_n_n = (double *)calloc(d * d, sizeof(double));
+
+	{
+		std::lock_guard<std::mutex> lkBase(*pLDA->baseLock);
+		acc_merge(pLDA->base, frozen, 1);
+		{
+			std::lock_guard<std::mutex> lk(*pLDA->lock);
+			pLDA->frozen = NULL;
+		}
+		if (Sw && Sb && t_n && t_n_n && pLDA->base->count > 0 && sol_alloc(&sol, d, q) == 0){
+			lda_scatter(&pLDA->base, 1, t, pLDA->shift, Sw, Sb, sol.M, sol.Nk, t_n, t_n_n);
+			sol.nSolved = pLDA->base->count;
+			status = 0;
+		}
+	}
+
+	acc_clear(frozen, 0);
+	{
+		std::lock_guard<std::mutex> lk(*pLDA->lock);
+		pLDA->spare = frozen;
+	}
+
+	if (status == 0 && lda_eigen(&sol, d, q, Sw, Sb, t_n, NULL) == 0)
+		hModel = lda_publish(pLDA, &sol);
+	status = hModel ? 0 : -1;
+
+	if (Sw)
+		free(Sw);
+	if (Sb)
+		free(Sb);
+	if (t_n)
+		free(t_n);
+	if (t_n_n)
+		free(t_n_n);
+	sol_free(&sol);
+
+	if (callback)
+		callback(user, hModel, status);
+	if (hModel)
+		LDA_ModelRelease(hModel);
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	pLDA->pAsync->status = status;
+	pLDA->pAsync->bBusy = FALSE;
+}
+
+// Starts a new epoch and solves everything up to it in the background.
+// Fails while a previous background solve is running, and on windowed
+// handles, whose blocks are epochs of their own; callback, if not
+// NULL, runs on the worker thread with a model that is only valid for the
+// duration of the call (LDA_ModelRetain keeps it).
+INT LDA_SolveAsync(HANDLE hLDA, LDA_CALLBACK callback, void *user)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	ASYNC *pAsync;
+	ACCUM *frozen;
+	double t;
+
+	if (pLDA == NULL)
+		return -1;
+	pAsync = pLDA->pAsync;
+
+	{
+		std::lock_guard<std::mutex> lk(*pLDA->lock);
+		if (pLDA->bTrained || pAsync->bBusy || pLDA->block != 0 || pLDA->acc->count == 0)
+			return -1;
+		pAsync->bBusy = TRUE;
+	}
+	{
+		std::lock_guard<std::mutex> lk(*pLDA->solLock);
+		pAsync->bPublish = true;
+	}
+
+	// held until the new worker is in place, so a concurrent
+	// LDA_SolveWait sees either thread but never one half assigned
+	std::lock_guard<std::mutex> lkJoin(pAsync->joinLock);
+
+	// the previous worker has finished, only its thread is left to reap
+	if (pAsync->worker.joinable())
+		pAsync->worker.join();
+
+	if (pLDA->spare == NULL){
+		pLDA->spare = acc_create(pLDA->d, pLDA->q);
+		if (pLDA->spare == NULL){
+			std::lock_guard<std::mutex> lk(*pLDA->lock);
+			pAsync->bBusy = FALSE;
+			return -1;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(*pLDA->lock);
+		frozen = pLDA->acc;
+		pLDA->frozen = frozen;
+		pLDA->acc = pLDA->spare;
+		pLDA->acc->t0 = pLDA->t;
+		pLDA->spare = NULL;
+		t = pLDA->t;
+	}
+
+	pAsync->worker = std::thread(lda_worker, pLDA, frozen, t, callback, user);
+
+	return 0;
+}
+
+// Waits for the background solve, if any, and returns its status.
+INT LDA_SolveWait(HANDLE hLDA)
+{
+	LDA *pLDA = (LDA *)hLDA;
+
+	if (pLDA == NULL || pLDA->pAsync == NULL)
+		return -1;
+
+	{
+		std::lock_guard<std::mutex> lk(pLDA->pAsync->joinLock);
+		if (pLDA->pAsync->worker.joinable())
+			pLDA->pAsync->worker.join();
+	}
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	return pLDA->pAsync->status;
+}
+
+// Latest published model with a reference taken for the caller, or NULL
+// before the first solve. Never blocks on ingestion or on a running solve.
+// The first call on a handle publishes its current solution and turns on
+// publishing for the solves that follow.
+HANDLE LDA_AcquireModel(HANDLE hLDA)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	ASYNC *pAsync;
+	HANDLE hModel = NULL;
+
+	if (pLDA == NULL)
+		return NULL;
+	pAsync = pLDA->pAsync;
+
+	if (!pAsync->bPublish.load()){
+		std::lock_guard<std::mutex> lk(*pLDA->solLock);
+		if (!pAsync->bPublish.load()){
+			pAsync->bPublish = true;
+			if (pLDA->sol.W)
+				hModel = lda_publish(pLDA, &pLDA->sol);
+		}
+	}
+	if (hModel)
+		LDA_ModelRelease(hModel);
+
+	std::lock_guard<std::mutex> lk(pAsync->pubLock);
+	hModel = pAsync->current;
+	if (hModel)
+		LDA_ModelRetain(hModel);
+
+	return hModel;
+}
+
+// U = V * W for n rows, keeping the first k columns of W (row stride ldw).
+// The project kernel keeps a row of U in registers across all of W, whose
+// k used columns stay in cache from one row of V to the next.
+int lda_project(const double *w, int ldw, int d, int k, const double *v, int n, double *u)
+{
+	const LDAKERNEL *K = lda_kernel();
+	LDAPERFMARK mark;
+	INT r;
+
+	lda_perf_begin(&mark);
+	memset(u, 0, sizeof(double) * n * k);
+	for (r = 0; r < n; r++)
+		K->project(d, k, w, ldw, v + (INT64)r * d, u + (INT64)r * k);
+	lda_perf_end(&mark, LDA_PERF_PROJECT);
+
+	return n;
+}
+
+INT LDA_Project(const double *eigenvector, INT d, INT k, const double *v, INT n, double *u)
+{
+	if (eigenvector == NULL || v == NULL || u == NULL || v == u)
+		return -1;
+	if (d <= 0 || k <= 0 || k > d || n < 0)
+		return -1;
+
+	return lda_project(eigenvector, d, d, k, v, n, u);
+}
+
+// Nearest centroid in the scaled discriminant space:
+//   score[c] = -0.5 * |y - m_c|^2 + logPrior[c],  y = (x * W) .* scale
+// evaluated as y.m_c - 0.5*|m_c|^2 - 0.5*|y|^2, so each block of samples
+// is scored against all centroids with one small matrix product.
+int lda_classify(const double *w, int ldw, int d, int k, const double *scale, const double *centroid, int q,
+	const double *logPrior, const double *v, int n, INT *label, double *score)
+{
+	double *y = NULL;
+	double *bias = NULL;
+	const double *m;
+	double *yr, *sr;
+	double yy, g, best;
+	INT r, r0, nb, i, c, arg;
+	double t[LDA_BLOCK];
+
+	y = (double *)malloc(sizeof(double) * LDA_BLOCK * k);
+	bias = (double *)malloc(sizeof(double) * q);
+	if (y == NULL || bias == NULL){
+		if (y)
+			free(y);
+		if (bias)
+			free(bias);
+		return -1;
+	}
+
+	for (c = 0; c < q; c++){
+		m = centroid + (INT64)c * k;
+		g = 0;
+		for (i = 0; i < k; i++)
+			g += m[i] * m[i];
+		bias[c] = -0.5 * g + (logPrior ? logPrior[c] : 0);
+	}
+
+	for (r0 = 0; r0 < n; r0 += nb){
+		nb = MIN(LDA_BLOCK, n - r0);
+		lda_project(w, ldw, d, k, v + (INT64)r0 * d, nb, y);
+		for (r = 0; r < nb; r++){
+			yr = y + r * k;
+			yy = 0;
+			for (i = 0; i < k; i++){
+				yr[i] *= scale[i];
+				yy += yr[i] * yr[i];
+			}
+			t[r] = -0.5 * yy;
+		}
+
+		for (r = 0; r < nb; r++){
+			yr = y + r * k;
+			sr = score ? score + (INT64)(r0 + r) * q : NULL;
+			best = -HUGE_VAL;
+			arg = 0;
+			for (c = 0; c < q; c++){
+				m = centroid + (INT64)c * k;
+				g = 0;
+				for (i = 0; i < k; i++)
+					g += yr[i] * m[i];
+				g += bias[c] + t[r];
+				if (sr)
+					sr[c] = g;
+				if (g > best){
+					best = g;
+					arg = c;
+				}
+			}
+			if (label)
+				label[r0 + r] = arg;
+		}
+	}
+
+	free(y);
+	free(bias);
+
+	return n;
+}
+
+INT LDA_Classify(HANDLE hLDA, const double *v, INT n, BOOL bPriors, INT *label, double *score)
+{
+	LDA *pLDA = (LDA *)hLDA;
+
+	SOLUTION *pSol;
+
+	if (pLDA == NULL)
+		return -1;
+	if (v == NULL || n < 0 || (label == NULL && score == NULL))
+		return -1;
+
+	std::lock_guard<std::mutex> lk(*pLDA->solLock);
+	if (pLDA->sol.W == NULL)
+		return -1;
+	pSol = &pLDA->sol;
+
+	return lda_classify(pSol->W, pLDA->d, pLDA->d, pSol->kc, pSol->scale, pSol->centroid, pLDA->q,
+		bPriors ? pSol->logPrior : NULL, v, n, label, score);
+}
+
+INT LDA_SaveModel(HANDLE hLDA, const char *file, INT k)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	SOLUTION *pSol;
+	double *centroid = NULL;
+	INT q, ret;
+
+	if (pLDA == NULL)
+		return -1;
+	if (k <= 0 || k > pLDA->d)
+		return -1;
+
+	q = pLDA->q;
+	centroid = (double *)malloc(sizeof(double) * q * k);
+	if (centroid == NULL)
+		return -1;
+
+	std::lock_guard<std::mutex> lk(*pLDA->solLock);
+	if (pLDA->sol.W == NULL){
+		free(centroid);
+		return -1;
+	}
+	pSol = &pLDA->sol;
+
+	lda_centroid(pSol, pLDA->d, q, k, centroid);
+
+	ret = LDA_ModelWrite(file, pLDA->d, k, q, pSol->W, pSol->lambda, pSol->M, pSol->Nk,
+		pSol->scale, centroid);
+
+	free(centroid);
+
+	return ret;
+}
+
+static void acc_copy(ACCUM *dst, const ACCUM *src)
+{
+	INT d = dst->d;
+	INT q = dst->q;
+
+	memcpy(dst->S[0], src->S[0], sizeof(double) * q * d * d);
+	memcpy(dst->C[0], src->C[0], sizeof(double) * q * d);
+	memcpy(dst->N, src->N, sizeof(double) * q);
+	dst->count = src->count;
+	dst->t0 = src->t0;
+}
+
+typedef struct CVFOLD {
+	LDA *pLDA;				// holds the shifts shared by all folds
+	ACCUM **fold;
+	ACCUM *total;
+	INT folds;
+	const double *v;
+	const INT *k;
+	INT n;
+	BOOL bPriors;
+	double *accuracy;
+	std::atomic<INT> next;
+	std::atomic<INT> status;
+} CVFOLD;
+
+#define CV_ROWS		256		// rows gathered at a time
+
+// Copies up to m rows of fold f, rows f, f + folds, ..., starting at its
+// i-th, into x and their labels into label; returns how many there were
+static INT cv_gather(const CVFOLD *pCV, INT d, INT f, INT i, INT m, double *x, INT *label)
+{
+	INT64 r;
+	INT j;
+
+	for (j = 0; j < m; j++){
+		r = (INT64)(i + j) * pCV->folds + f;
+		if (r >= pCV->n)
+			break;
+		memcpy(x + (INT64)j * d, pCV->v + r * d, sizeof(double) * d);
+		if (label)
+			label[j] = pCV->k[r];
+	}
+	return j;
+}
+
+// Solves the training set of each fold it claims, total minus the fold,
+// and scores the held-out rows.
+static void cv_worker(CVFOLD *pCV)
+{
+	LDA *pLDA = pCV->pLDA;
+	INT d = pLDA->d;
+	INT q = pLDA->q;
+	SOLUTION sol;
+	ACCUM *train;
+	double *Sw, *Sb, *t_n, *t_n_n, *x;
+	INT *label, *truth;
+	INT f, r, i, m, hit, total;
+
+	memset(&sol, 0, sizeof(sol));
+	train = acc_create(d, q);
+	Sw = (double *)malloc(sizeof(double) * d * d);
+	Sb = (double *)malloc(sizeof(double) * d * d);
+	t_n = (double *)malloc(sizeof(double) * d);
+	t_n_n = (double *)malloc(sizeof(double) * d * d);
+	x = (double *)malloc(sizeof(double) * CV_ROWS * d);
+	label = (INT *)malloc(sizeof(INT) * CV_ROWS);
+	truth = (INT *)malloc(sizeof(INT) * CV_ROWS);
+	if (train == NULL || Sw == NULL || Sb == NULL || t_n == NULL || t_n_n == NULL || x == NULL ||
+		label == NULL || truth == NULL || sol_alloc(&sol, d, q) != 0){
+		pCV->status = -1;
+		goto L_EXIT;
+	}
+
+	while ((f = pCV->next.fetch_add(1)) < pCV->folds){
+		acc_copy(train, pCV->total);
+		acc_merge(train, pCV->fold[f], -1);
+		if (train->count == 0){
+			pCV->status = -1;
+			continue;
+		}
+		lda_scatter(&train, 1, 0, pLDA->shift, Sw, Sb, sol.M, sol.Nk, t_n, t_n_n);
+		sol.nSolved = train->count;
+		if (lda_eigen(&sol, d, q, Sw, Sb, t_n, NULL) != 0){
+			pCV->status = -1;
+			continue;
+		}
+
+		hit = 0;
+		total = 0;
+		for (i = 0; (m = cv_gather(pCV, d, f, i, CV_ROWS, x, truth)) > 0; i += m){
+			lda_classify(sol.W, d, d, sol.kc, sol.scale, sol.centroid, q, pCV->bPriors ? sol.logPrior : NULL,
+				x, m, label, NULL);
+			for (r = 0; r < m; r++){
+				if (label[r] == truth[r])
+					hit++;
+			}
+			total += m;
+		}
+		pCV->accuracy[f] = (total > 0) ? (double)hit / total : 0;
+	}
+
+L_EXIT:
+
+	acc_release(train);
+	if (Sw)
+		free(Sw);
+	if (Sb)
+		free(Sb);
+	if (t_n)
+		free(t_n);
+	if (t_n_n)
+		free(t_n_n);
+	if (x)
+		free(x);
+	if (label)
+		free(label);
+	if (truth)
+		free(truth);
+	sol_free(&sol);
+}
+
+// k-fold cross-validation of the nearest-centroid classifier. Fold f holds
+// out rows f, f + folds, f + 2*folds, ..., which stratifies input sorted
+// by class as the data files are. The data is read once into one
+// accumulator per fold; every training set is the total minus its fold,
+// and the folds are solved in parallel. accuracy receives the held-out
+// accuracy of each fold.
+INT LDA_CrossValidate(const double *v, const INT *k, INT n, INT d, INT q, INT folds, BOOL bPriors, double *accuracy)
+{
+	LDA *pLDA = NULL;
+	ACCUM *open;
+	CVFOLD cv;
+	std::thread *worker = NULL;
+	double *x = NULL;
+	INT *label = NULL;
+	INT f, i, m, nThread;
+
+	if (v == NULL || k == NULL || accuracy == NULL || folds < 2 || n < folds)
+		return -1;
+
+	pLDA = (LDA *)LDA_Create(d, q);
+	if (pLDA == NULL)
+		return -1;
+	open = pLDA->acc;
+
+	cv.pLDA = pLDA;
+	cv.folds = folds;
+	cv.v = v;
+	cv.k = k;
+	cv.n = n;
+	cv.bPriors = bPriors;
+	cv.accuracy = accuracy;
+	cv.next = 0;
+	cv.status = 0;
+	cv.total = acc_create(d, q);
+	cv.fold = (ACCUM **)calloc(folds, sizeof(ACCUM *));
+	x = (double *)malloc(sizeof(double) * CV_ROWS * d);
+	label = (INT *)malloc(sizeof(INT) * CV_ROWS);
+	if (cv.total == NULL || cv.fold == NULL || x == NULL || label == NULL)
+		goto L_ERROR;
+
+	// one pass over the data, each fold into its own accumulator
+	for (f = 0; f < folds; f++){
+		cv.fold[f] = acc_create(d, q);
+		if (cv.fold[f] == NULL)
+			goto L_ERROR;
+		pLDA->acc = cv.fold[f];
+		for (i = 0; (m = cv_gather(&cv, d, f, i, CV_ROWS, x, label)) > 0; i += m){
+			if (LDA_AddBatch(pLDA, x, label, m) < 0)
+				goto L_ERROR;
+		}
+		acc_merge(cv.total, cv.fold[f], 1);
+	}
+	pLDA->acc = open;
+	free(x);
+	free(label);
+	x = NULL;
+	label = NULL;
+
+	nThread = MAX(1, MIN(folds, (INT)std::thread::hardware_concurrency()));
+	worker = new std::thread [nThread];
+	for (f = 0; f < nThread; f++)
+		worker[f] = std::thread(cv_worker, &cv);
+	for (f = 0; f < nThread; f++)
+		worker[f].join();
+	delete [] worker;
+
+	if (cv.status != 0)
+		goto L_ERROR;
+
+	for (f = 0; f < folds; f++)
+		acc_release(cv.fold[f]);
+	free(cv.fold);
+	acc_release(cv.total);
+	LDA_Release(pLDA);
+
+	return 0;
+
+L_ERROR:
+
+	pLDA->acc = open;
+	if (x)
+		free(x);
+	if (label)
+		free(label);
+	if (cv.fold){
+		for (f = 0; f < folds; f++)
+			acc_release(cv.fold[f]);
+		free(cv.fold);
+	}
+	acc_release(cv.total);
+	LDA_Release(pLDA);
+
+	return -1;
+}
+
+// Locks subLock and brings subSw/subB/subN up to date with the running sums.
+// Returns with the lock held on success.
+static INT lda_subset_lock(LDA *pLDA)
+{
+	SOLUTION sol;
+	double *Sb = NULL;
+	double *t_n = NULL;
+	double *t_n_n = NULL;
+	double *mu;
+	INT d = pLDA->d;
+	INT q = pLDA->q;
+	INT i, c, count;
+	double total;
+
+	pLDA->subLock->lock();
+
+	{
+		std::lock_guard<std::mutex> lk(*pLDA->lock);
+		count = pLDA->count;
+	}
+	if (count == pLDA->subCount)
+		return 0;
+
+	memset(&sol, 0, sizeof(sol));
+	if (pLDA->subSw == NULL){
+		pLDA->subSw = (double *)malloc(sizeof(double) * d * d);
+		pLDA->subB = (double *)malloc(sizeof(double) * d * q);
+	}
+	Sb = (double *)malloc(sizeof(double) * d * d);
+	t_n = (double *)malloc(sizeof(double) * d);
+	t_n_n = (double *)malloc(sizeof(double) * d * d);
+	sol.M = (double *)malloc(sizeof(double) * q * d);
+	sol.Nk = (double *)malloc(sizeof(double) * q);
+	if (pLDA->subSw == NULL || pLDA->subB == NULL || Sb == NULL || t_n == NULL || t_n_n == NULL ||
+		sol.M == NULL || sol.Nk == NULL ||
+		lda_gather(pLDA, &sol, pLDA->subSw, Sb, t_n, t_n_n, FALSE) != 0){
+		sol_free(&sol);
+		if (Sb)
+			free(Sb);
+		if (t_n)
+			free(t_n);
+		if (t_n_n)
+			free(t_n_n);
+		pLDA->subLock->unlock();
+		return -1;
+	}
+
+	// B[:,c] = sqrt(N[c]) * (m[c] - mu)
+	mu = t_n;
+	total = 0;
+	memset(mu, 0, sizeof(double) * d);
+	for (c = 0; c < q; c++){
+		total += sol.Nk[c];
+		for (i = 0; i < d; i++)
+			mu[i] += sol.Nk[c] * sol.M[c*d + i];
+	}
+	for (i = 0; i < d; i++)
+		mu[i] /= total;
+	for (i = 0; i < d; i++){
+		for (c = 0; c < q; c++)
+			pLDA->subB[i*q + c] = sqrt(sol.Nk[c]) * (sol.M[c*d + i] - mu[i]);
+	}
+	pLDA->subN = total;
+	pLDA->subCount = sol.nSolved;
+
+	sol_free(&sol);
+	free(Sb);
+	free(t_n);
+	free(t_n_n);
+
+	return 0;
+}
+
+// Principal m*m submatrix of Sw and the m*q rows of B of a subset
+static INT lda_subset_get(LDA *pLDA, const INT *idx, INT m, double *Sw, double *B)
+{
+	INT d = pLDA->d;
+	INT q = pLDA->q;
+	INT i, j;
+
+	for (i = 0; i < m; i++){
+		if (idx[i] < 0 || idx[i] >= d)
+			return -1;
+	}
+	if (lda_subset_lock(pLDA) != 0)
+		return -1;
+	for (i = 0; i < m; i++){
+		for (j = 0; j < m; j++)
+			Sw[i*m + j] = pLDA->subSw[idx[i]*d + idx[j]];
+		memcpy(B + i*q, pLDA->subB + idx[i]*q, sizeof(double) * q);
+	}
+	pLDA->subLock->unlock();
+	return 0;
+}
+
+// LDA restricted to the features idx[0..m-1], solved from the existing
+// sums: the subset's Sw and Sb are principal submatrices of the full ones.
+// eigenvector is m*m in the layout of LDA_Solve.
+INT LDA_SolveSubset(HANDLE hLDA, const INT *idx, INT m, double *eigenvector, double *eigenvalue)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	double *Sw = NULL;
+	double *Sb = NULL;
+	double *B = NULL;
+	double *V = NULL;
+	double *lambda = NULL;
+	INT q, i, j, c, ret = -1;
+
+	if (pLDA == NULL || idx == NULL || m <= 0 || m > pLDA->d)
+		return -1;
+	q = pLDA->q;
+
+	Sw = (double *)malloc(sizeof(double) * m * m);
+	Sb = (double *)malloc(sizeof(double) * m * m);
+	B = (double *)malloc(sizeof(double) * m * q);
+	V = (double *)malloc(sizeof(double) * m * m);
+	lambda = (double *)malloc(sizeof(double) * m);
+	if (Sw && Sb && B && V && lambda && lda_subset_get(pLDA, idx, m, Sw, B) == 0){
+		for (i = 0; i < m; i++){
+			for (j = 0; j < m; j++){
+				Sb[i*m + j] = 0;
+				for (c = 0; c < q; c++)
+					Sb[i*m + j] += B[i*q + c] * B[j*q + c];
+			}
+		}
+		ret = GeneralizedEigenvalueDecomposition(m, Sb, Sw, V, lambda, NULL);
+		if (ret == 0 && eigenvector)
+			memcpy(eigenvector, V, sizeof(double) * m * m);
+		if (ret == 0 && eigenvalue)
+			memcpy(eigenvalue, lambda, sizeof(double) * m);
+	}
+
+	if (Sw)
+		free(Sw);
+	if (Sb)
+		free(Sb);
+	if (B)
+		free(B);
+	if (V)
+		free(V);
+	if (lambda)
+		free(lambda);
+
+	return ret;
+}
+
+// Fisher criterion trace(Sw^-1 * Sb) of the features idx[0..m-1], i.e. the
+// sum of the subset's LDA eigenvalues, as |L^-1 * B|^2 with Sw = L*L' and
+// Sb = B*B'. Fails when the subset's Sw is singular.
+INT LDA_FisherScore(HANDLE hLDA, const INT *idx, INT m, double *score)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	double *Sw = NULL;
+	double *B = NULL;
+	INT q, i, ret = -1;
+
+	if (pLDA == NULL || idx == NULL || score == NULL || m <= 0 || m > pLDA->d)
+		return -1;
+	q = pLDA->q;
+
+	Sw = (double *)malloc(sizeof(double) * m * m);
+	B = (double *)malloc(sizeof(double) * m * q);
+	if (Sw && B && lda_subset_get(pLDA, idx, m, Sw, B) == 0 && CholeskyDecomposition(m, Sw) == 0){
+		CholeskyForward(m, Sw, q, B, q);
+		*score = 0;
+		for (i = 0; i < m * q; i++)
+			*score += B[i] * B[i];
+		ret = 0;
+	}
+
+	if (Sw)
+		free(Sw);
+	if (B)
+		free(B);
+
+	return ret;
+}
+
+// Greedy stepwise selection of m features by the Fisher criterion, from
+// one accumulation. Forward search grows the subset one feature at a time
+// by bordering its Cholesky factor (O(p*p) per candidate); backward search
+// starts from all d features and drops the least useful one, removing it
+// from the inverse of their Sw with a rank-one downdate (O(p*p) per step).
+// idx receives the m features in
+// the order chosen (forward) or in ascending order (backward), score the
+// criterion of the result.
+INT LDA_SelectFeatures(HANDLE hLDA, INT m, BOOL bBackward, INT *idx, double *score)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	INT d, q, p, i, j, r, c, best;
+	INT *sel = NULL;
+	BOOL *used = NULL;
+	double *Sw = NULL;
+	double *B = NULL;
+	double *L = NULL;
+	double *Z = NULL;
+	double *Li = NULL;
+	double *x = NULL;
+	double *z = NULL;
+	double J, g, t, bestGain, a;
+	INT ret = -1;
+
+	if (pLDA == NULL || idx == NULL || m <= 0 || m > pLDA->d)
+		return -1;
+	d = pLDA->d;
+	q = pLDA->q;
+
+	sel = (INT *)malloc(sizeof(INT) * d);
+	used = (BOOL *)calloc(d, sizeof(BOOL));
+	Sw = (double *)malloc(sizeof(double) * d * d);
+	B = (double *)malloc(sizeof(double) * d * q);
+	L = (double *)calloc(d * d, sizeof(double));
+	Z = (double *)malloc(sizeof(double) * d * q);
+	Li = (double *)malloc(sizeof(double) * d * d);
+	x = (double *)malloc(sizeof(double) * d);
+	z = (double *)malloc(sizeof(double) * 2 * q);
+	if (sel == NULL || used == NULL || Sw == NULL || B == NULL || L == NULL || Z == NULL ||
+		Li == NULL || x == NULL || z == NULL)
+		goto L_EXIT;
+
+	for (i = 0; i < d; i++)
+		sel[i] = i;
+	if (lda_subset_get(pLDA, sel, d, Sw, B) != 0)
+		goto L_EXIT;
+
+	J = 0;
+	if (!bBackward){
+		// L (stride d) and Z = L^-1 * B[sel] grow by one row per step:
+		//   l = L^-1 * Sw[sel,j],  l_jj = sqrt(Sw[j,j] - l'l)
+		//   z = (B[j] - l'Z) / l_jj,  J += z'z
+		for (p = 0; p < m; p++){
+			best = -1;
+			bestGain = -1;
+			for (j = 0; j < d; j++){
+				if (used[j])
+					continue;
+				for (r = 0; r < p; r++){
+					t = Sw[sel[r]*d + j];
+					for (c = 0; c < r; c++)
+						t -= L[r*d + c] * x[c];
+					x[r] = t / L[r*d + r];
+				}
+				a = Sw[j*d + j];
+				for (r = 0; r < p; r++)
+					a -= x[r] * x[r];
+				if (!(a > 1e-12 * Sw[j*d + j]))
+					continue;
+				a = sqrt(a);
+				g = 0;
+				for (c = 0; c < q; c++){
+					t = B[j*q + c];
+					for (r = 0; r < p; r++)
+						t -= x[r] * Z[r*q + c];
+					z[c] = t / a;
+					g += z[c] * z[c];
+				}
+				if (g > bestGain){
+					bestGain = g;
+					best = j;
+					memcpy(z + q, z, sizeof(double) * q);
+					memcpy(Li, x, sizeof(double) * p);
+					Li[p] = a;
+				}
+			}
+			if (best < 0)
+				goto L_EXIT;
+			sel[p] = best;
+			used[best] = TRUE;
+			memcpy(L + p*d, Li, sizeof(double) * (p + 1));
+			memcpy(Z + p*q, z + q, sizeof(double) * q);
+			J += bestGain;
+		}
+		memcpy(idx, sel, sizeof(INT) * m);
+	}
+	else {
+		// G = A^-1 of the remaining features (in L, stride d) and
+		// H = G * B[sel] (in Z), from one factorization A = L*L'
+		memcpy(L, Sw, sizeof(double) * d * d);
+		if (CholeskyDecomposition(d, L) != 0)
+			goto L_EXIT;
+		for (r = 0; r < d; r++){
+			for (c = 0; c <= r; c++){
+				t = (r == c) ? 1 : 0;
+				for (j = c; j < r; j++)
+					t -= L[r*d + j] * Li[j*d + c];
+				Li[r*d + c] = t / L[r*d + r];
+			}
+		}
+		for (r = 0; r < d; r++){
+			for (c = 0; c <= r; c++){
+				t = 0;
+				for (j = r; j < d; j++)
+					t += Li[j*d + r] * Li[j*d + c];
+				L[r*d + c] = t;
+				L[c*d + r] = t;
+			}
+		}
+		for (r = 0; r < d; r++){
+			for (c = 0; c < q; c++){
+				t = 0;
+				for (j = 0; j < d; j++)
+					t += L[r*d + j] * B[j*q + c];
+				Z[r*q + c] = t;
+				J += B[r*q + c] * t;
+			}
+		}
+
+		// dropping feature i costs |H_i|^2 / G_ii; the remaining block
+		// then has G' = G - g*g'/G_ii and H' = H - g*H_i/G_ii, g = G[:,i]
+		for (p = d; p > m; p--){
+			best = -1;
+			bestGain = HUGE_VAL;
+			for (i = 0; i < p; i++){
+				g = 0;
+				for (c = 0; c < q; c++)
+					g += Z[i*q + c] * Z[i*q + c];
+				g /= L[i*d + i];
+				if (g < bestGain){
+					bestGain = g;
+					best = i;
+				}
+			}
+
+			// rows and columns after best move up one as they are updated
+			a = L[best*d + best];
+			for (r = 0; r < p; r++)
+				x[r] = L[r*d + best] / a;
+			memcpy(z, Z + best*q, sizeof(double) * q);
+			for (r = 0, i = 0; r < p; r++){
+				if (r == best)
+					continue;
+				for (c = 0, j = 0; c < p; c++){
+					if (c == best)
+						continue;
+					L[i*d + j] = L[r*d + c] - x[r] * a * x[c];
+					j++;
+				}
+				for (c = 0; c < q; c++)
+					Z[i*q + c] = Z[r*q + c] - x[r] * z[c];
+				i++;
+			}
+			for (r = best; r < p - 1; r++)
+				sel[r] = sel[r + 1];
+			J -= bestGain;
+		}
+		memcpy(idx, sel, sizeof(INT) * m);
+	}
+
+	if (score)
+		*score = J;
+	ret = 0;
+
+L_EXIT:
+
+	if (sel)
+		free(sel);
+	if (used)
+		free(used);
+	if (Sw)
+		free(Sw);
+	if (B)
+		free(B);
+	if (L)
+		free(L);
+	if (Z)
+		free(Z);
+	if (Li)
+		free(Li);
+	if (x)
+		free(x);
+	if (z)
+		free(z);
+
+	return ret;
+}
+
+// Oracle approximating shrinkage (Chen et al.) of the within-class
+// covariance toward a multiple of the identity, expressed as the lambda
+// of Sw + lambda*I (in the units of Sw) that gives the same discriminants.
+// It needs only trace(Sw) and trace(Sw*Sw), so it comes from the running
+// sums; rho receives the shrinkage intensity in [0, 1]. At rho = 1 the
+// scatter carries no usable information and lambda is HUGE_VAL.
+INT LDA_Shrinkage(HANDLE hLDA, double *lambda, double *rho)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	double tr, tr2, n, p, num, den, r;
+	INT d, i, j;
+
+	if (pLDA == NULL || lambda == NULL)
+		return -1;
+	if (lda_subset_lock(pLDA) != 0)
+		return -1;
+	d = pLDA->d;
+	tr = 0;
+	tr2 = 0;
+	for (i = 0; i < d; i++){
+		tr += pLDA->subSw[i*d + i];
+		for (j = 0; j < d; j++)
+			tr2 += pLDA->subSw[i*d + j] * pLDA->subSw[i*d + j];
+	}
+	n = pLDA->subN;
+	pLDA->subLock->unlock();
+
+	// on the covariance Sw/n
+	tr /= n;
+	tr2 /= n * n;
+	p = d;
+	num = (1 - 2 / p) * tr2 + tr * tr;
+	den = (n + 1 - 2 / p) * (tr2 - tr * tr / p);
+	r = (den > 0) ? MIN(1.0, num / den) : 1.0;
+
+	if (rho)
+		*rho = r;
+	*lambda = (r < 1) ? r / (1 - r) * tr * n / p : HUGE_VAL;
+
+	return 0;
+}
+
+// The q*q core of the low-rank solves: in a basis where the pencil's
+// right-hand matrix is diag(s) (r values) and Sb = C*C' (C r*q), the
+// problem reduces to C'*diag(s)^-1*C*u = l*u. Z (r*k) receives
+// diag(s)^-1*C*u for the k largest l, mu all q of them in ascending order.
+// H is q*q scratch.
+static INT lda_lowrank(INT r, INT q, INT k, const double *s, const double *C, double *Z, double *H, double *mu)
+{
+	double a, t;
+	INT i, j, c;
+
+	memset(H, 0, sizeof(double) * q * q);
+	for (i = 0; i < r; i++){
+		a = 1 / s[i];
+		for (j = 0; j < q; j++){
+			t = a * C[i*q + j];
+			for (c = 0; c <= j; c++)
+				H[j*q + c] += t * C[i*q + c];
+		}
+	}
+	if (SymmetricEigenDecomposition(q, H, mu) != 0)
+		return -1;
+
+	for (i = 0; i < r; i++){
+		a = 1 / s[i];
+		for (j = 0; j < k; j++){
+			t = 0;
+			for (c = 0; c < q; c++)
+				t += C[i*q + c] * H[c*q + q - 1 - j];
+			Z[i*k + j] = a * t;
+		}
+	}
+
+	return 0;
+}
+
+// Scales the columns of the d*k V like LDA_Solve (largest component 1) and
+// stores their eigenvalues; column j belongs to mu[q-1-j]. Columns past the
+// rank of Sb, where mu is at rounding level, are zeroed.
+static void lda_columns(double *V, INT d, INT k, const double *mu, INT q, double *eigenvalue)
+{
+	double t;
+	INT r, j;
+
+	for (j = 0; j < k; j++){
+		if (!(mu[q - 1 - j] > q * 2.22e-16 * mu[q - 1])){
+			for (r = 0; r < d; r++)
+				V[r*k + j] = 0;
+			if (eigenvalue)
+				eigenvalue[j] = 0;
+			continue;
+		}
+		t = 0;
+		for (r = 0; r < d; r++){
+			if (fabs(V[r*k + j]) > fabs(t))
+				t = V[r*k + j];
+		}
+		for (r = 0; r < d; r++)
+			V[r*k + j] /= t;
+		if (eigenvalue)
+			eigenvalue[j] = mu[q - 1 - j];
+	}
+}
+
+// V = U(:, 0..r-1) * Z, U d*ldu, Z r*k
+static void lda_lift(INT d, INT r, INT k, const double *U, INT ldu, const double *Z, double *V)
+{
+	double t;
+	INT i, j, c;
+
+	memset(V, 0, sizeof(double) * d * k);
+	for (i = 0; i < d; i++){
+		for (c = 0; c < r; c++){
+			t = U[i*ldu + c];
+			for (j = 0; j < k; j++)
+				V[i*k + j] += t * Z[c*k + j];
+		}
+	}
+}
+
+// C = U(:, 0..r-1)' * B, U d*ldu, B d*q
+static void lda_rotate(INT d, INT r, INT q, const double *U, INT ldu, const double *B, double *C)
+{
+	double t;
+	INT i, j, c;
+
+	memset(C, 0, sizeof(double) * r * q);
+	for (i = 0; i < d; i++){
+		for (j = 0; j < r; j++){
+			t = U[i*ldu + j];
+			for (c = 0; c < q; c++)
+				C[j*q + c] += t * B[i*q + c];
+		}
+	}
+}
+
+// Regularized LDA, Sb*v = l*(Sw + lambda*I)*v, for each of the nLambda
+// values of lambda (>= 0, in the units of Sw). Sw = U*D*U' is diagonalized
+// once; with C = U'*B every lambda then reduces to the q*q symmetric
+// problem C'*(D + lambda)^-1*C, and v = U*(D + lambda)^-1*C*u, so the whole
+// path costs about one solve. eigenvector receives nLambda blocks of d*k
+// (column j at row*k+j, normalized as in LDA_Solve), eigenvalue nLambda
+// rows of k values in descending order; k is at most min(d, q), and the
+// columns past the rank of Sb are zero.
+INT LDA_SolvePath(HANDLE hLDA, const double *lambda, INT nLambda, INT k, double *eigenvector, double *eigenvalue)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	double *U = NULL;
+	double *D = NULL;
+	double *B = NULL;
+	double *C = NULL;
+	double *H = NULL;
+	double *mu = NULL;
+	double *Z = NULL;
+	double *s = NULL;
+	double floor;
+	INT d, q, l, i;
+	INT ret = -1;
+
+	if (pLDA == NULL || lambda == NULL || eigenvector == NULL || nLambda <= 0)
+		return -1;
+	d = pLDA->d;
+	q = pLDA->q;
+	if (k <= 0 || k > MIN(d, q))
+		return -1;
+	for (l = 0; l < nLambda; l++){
+		if (!(lambda[l] >= 0 && lambda[l] < HUGE_VAL))
+			return -1;
+	}
+
+	U = (double *)malloc(sizeof(double) * d * d);
+	D = (double *)malloc(sizeof(double) * d);
+	B = (double *)malloc(sizeof(double) * d * q);
+	C = (double *)malloc(sizeof(double) * d * q);
+	H = (double *)malloc(sizeof(double) * q * q);
+	mu = (double *)malloc(sizeof(double) * q);
+	Z = (double *)malloc(sizeof(double) * d * k);
+	s = (double *)malloc(sizeof(double) * d);
+	if (U == NULL || D == NULL || B == NULL || C == NULL || H == NULL || mu == NULL || Z == NULL || s == NULL)
+		goto L_EXIT;
+
+	if (lda_subset_lock(pLDA) != 0)
+		goto L_EXIT;
+	memcpy(U, pLDA->subSw, sizeof(double) * d * d);
+	memcpy(B, pLDA->subB, sizeof(double) * d * q);
+	pLDA->subLock->unlock();
+
+	if (SymmetricEigenDecomposition(d, U, D) != 0)
+		goto L_EXIT;
+	lda_rotate(d, d, q, U, d, B, C);
+
+	// Sw + lambda*I must stay positive definite well above rounding
+	floor = d * 2.22e-16 * MAX(fabs(D[0]), fabs(D[d-1]));
+
+	for (l = 0; l < nLambda; l++){
+		for (i = 0; i < d; i++){
+			s[i] = D[i] + lambda[l];
+			if (!(s[i] > floor))
+				goto L_EXIT;
+		}
+		if (lda_lowrank(d, q, k, s, C, Z, H, mu) != 0)
+			goto L_EXIT;
+		lda_lift(d, d, k, U, d, Z, eigenvector + (INT64)l * d * k);
+		lda_columns(eigenvector + (INT64)l * d * k, d, k, mu, q, eigenvalue ? eigenvalue + l * k : NULL);
+	}
+	ret = 0;
+
+L_EXIT:
+
+	if (U)
+		free(U);
+	if (D)
+		free(D);
+	if (B)
+		free(B);
+	if (C)
+		free(C);
+	if (H)
+		free(H);
+	if (mu)
+		free(mu);
+	if (Z)
+		free(Z);
+	if (s)
+		free(s);
+
+	return ret;
+}
+
+// Rank of the leading eigenvalues, ascending in w[0..n-1], that stand clear
+// of rounding; the range of the scatter is spanned by the last r vectors.
+static INT lda_rank(INT n, INT m, const double *w)
+{
+	double tol;
+	INT r;
+
+	tol = m * 2.22e-16 * fabs(w[n-1]);
+	for (r = 0; r < n && w[n-1-r] > tol; r++)
+		;
+	return r;
+}
+
+// LDA in the range of the total scatter St = Sw + Sb, for d large against
+// the number of samples. In that subspace St is positive definite even
+// when Sw is singular, and Sb*v = l*St*v has the same eigenvectors as the
+// Fisher problem, so there are no infinite eigenvalues: eigenvalue is the
+// between-class share v'Sb*v / v'St*v in [0, 1], 1 for directions in the
+// null space of Sw. With St = U*D*U' the problem is the q*q one of
+// LDA_SolvePath on the r-dimensional range. eigenvector receives d*k
+// (column j at row*k+j), k at most min(d, q); rank receives r.
+INT LDA_SolveRange(HANDLE hLDA, INT k, double *eigenvector, double *eigenvalue, INT *rank)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	double *U = NULL;
+	double *D = NULL;
+	double *B = NULL;
+	double *C = NULL;
+	double *H = NULL;
+	double *mu = NULL;
+	double *Z = NULL;
+	INT d, q, r, i, j, c;
+	INT ret = -1;
+
+	if (pLDA == NULL || eigenvector == NULL)
+		return -1;
+	d = pLDA->d;
+	q = pLDA->q;
+	if (k <= 0 || k > MIN(d, q))
+		return -1;
+
+	U = (double *)malloc(sizeof(double) * d * d);
+	D = (double *)malloc(sizeof(double) * d);
+	B = (double *)malloc(sizeof(double) * d * q);
+	C = (double *)malloc(sizeof(double) * d * q);
+	H = (double *)malloc(sizeof(double) * q * q);
+	mu = (double *)malloc(sizeof(double) * q);
+	Z = (double *)malloc(sizeof(double) * d * k);
+	if (U == NULL || D == NULL || B == NULL || C == NULL || H == NULL || mu == NULL || Z == NULL)
+		goto L_EXIT;
+
+	if (lda_subset_lock(pLDA) != 0)
+		goto L_EXIT;
+	memcpy(B, pLDA->subB, sizeof(double) * d * q);
+	for (i = 0; i < d; i++){
+		for (j = 0; j <= i; j++){
+			U[i*d + j] = pLDA->subSw[i*d + j];
+			for (c = 0; c < q; c++)
+				U[i*d + j] += B[i*q + c] * B[j*q + c];
+		}
+	}
+	pLDA->subLock->unlock();
+
+	if (SymmetricEigenDecomposition(d, U, D) != 0)
+		goto L_EXIT;
+	r = lda_rank(d, d, D);
+	if (r == 0)
+		goto L_EXIT;
+
+	// the range is spanned by the last r columns
+	lda_rotate(d, r, q, U + d - r, d, B, C);
+	if (lda_lowrank(r, q, k, D + d - r, C, Z, H, mu) != 0)
+		goto L_EXIT;
+	lda_lift(d, r, k, U + d - r, d, Z, eigenvector);
+	lda_columns(eigenvector, d, k, mu, q, eigenvalue);
+	if (rank)
+		*rank = r;
+	ret = 0;
+
+L_EXIT:
+
+	if (U)
+		free(U);
+	if (D)
+		free(D);
+	if (B)
+		free(B);
+	if (C)
+		free(C);
+	if (H)
+		free(H);
+	if (mu)
+		free(mu);
+	if (Z)
+		free(Z);
+
+	return ret;
+}
+
+// LDA_SolveRange straight from n retained samples (labels k in [0, q)),
+// without ever forming a d*d matrix. With the centered samples X, the
+// range of St = X'*X comes from the n*n Gram matrix X*X' = Q*D*Q', whose
+// nonzero eigenvalues are those of St with eigenvectors X'*Q*D^-1/2. The
+// samples in that basis are Q*D^1/2, so Sb is read off the class means of
+// the rows of Q. Costs O(n*n*d + n^3) instead of O(d^3).
+INT LDA_SolveGram(const double *v, const INT *k, INT n, INT d, INT q, INT m,
+	double *eigenvector, double *eigenvalue, INT *rank)
+{
+	double *X = NULL;
+	double *G = NULL;
+	double *D = NULL;
+	double *C = NULL;
+	double *H = NULL;
+	double *mu = NULL;
+	double *Z = NULL;
+	double *Nk = NULL;
+	double *xi, *xj, *Q, *w;
+	double t;
+	INT i, j, c, r;
+	INT ret = -1;
+
+	if (v == NULL || k == NULL || eigenvector == NULL || n < 2 || d <= 0 || q <= 0)
+		return -1;
+	if (m <= 0 || m > MIN(d, q))
+		return -1;
+	for (i = 0; i < n; i++){
+		if (k[i] < 0 || k[i] >= q)
+			return -1;
+	}
+
+	X = (double *)malloc(sizeof(double) * n * d);
+	G = (double *)malloc(sizeof(double) * n * n);
+	D = (double *)malloc(sizeof(double) * MAX(n, d));
+	C = (double *)malloc(sizeof(double) * n * q);
+	H = (double *)malloc(sizeof(double) * q * q);
+	mu = (double *)malloc(sizeof(double) * q);
+	Z = (double *)malloc(sizeof(double) * n * m);
+	Nk = (double *)calloc(q, sizeof(double));
+	if (X == NULL || G == NULL || D == NULL || C == NULL || H == NULL || mu == NULL || Z == NULL || Nk == NULL)
+		goto L_EXIT;
+
+	// X = v - mean
+	memset(D, 0, sizeof(double) * d);
+	for (i = 0; i < n; i++){
+		for (j = 0; j < d; j++)
+			D[j] += v[(INT64)i*d + j];
+	}
+	for (j = 0; j < d; j++)
+		D[j] /= n;
+	for (i = 0; i < n; i++){
+		for (j = 0; j < d; j++)
+			X[(INT64)i*d + j] = v[(INT64)i*d + j] - D[j];
+	}
+
+	// G = X * X', lower triangle
+	for (i = 0; i < n; i++){
+		xi = X + (INT64)i*d;
+		for (j = 0; j <= i; j++){
+			xj = X + (INT64)j*d;
+			t = 0;
+			for (c = 0; c < d; c++)
+				t += xi[c] * xj[c];
+			G[i*n + j] = t;
+		}
+	}
+	if (SymmetricEigenDecomposition(n, G, D) != 0)
+		goto L_EXIT;
+	r = lda_rank(n, MAX(n, d), D);
+	if (r == 0)
+		goto L_EXIT;
+	Q = G + n - r;
+	w = D + n - r;
+
+	// C[:,c] = sqrt(N[c]) * (class mean of Q*D^1/2); Q has zero column means
+	memset(C, 0, sizeof(double) * r * q);
+	for (i = 0; i < n; i++){
+		Nk[k[i]] += 1;
+		for (j = 0; j < r; j++)
+			C[j*q + k[i]] += Q[i*n + j];
+	}
+	for (j = 0; j < r; j++){
+		for (c = 0; c < q; c++)
+			C[j*q + c] = (Nk[c] > 0) ? C[j*q + c] * sqrt(w[j] / Nk[c]) : 0;
+	}
+	if (lda_lowrank(r, q, m, w, C, Z, H, mu) != 0)
+		goto L_EXIT;
+
+	// v = X' * Q * D^-1/2 * z
+	for (j = 0; j < r; j++){
+		t = 1 / sqrt(w[j]);
+		for (c = 0; c < m; c++)
+			Z[j*m + c] *= t;
+	}
+	memset(C, 0, sizeof(double) * n * m);
+	for (i = 0; i < n; i++){
+		for (j = 0; j < r; j++){
+			t = Q[i*n + j];
+			for (c = 0; c < m; c++)
+				C[i*m + c] += t * Z[j*m + c];
+		}
+	}
+	memset(eigenvector, 0, sizeof(double) * d * m);
+	for (i = 0; i < n; i++){
+		xi = X + (INT64)i*d;
+		for (j = 0; j < d; j++){
+			t = xi[j];
+			for (c = 0; c < m; c++)
+				eigenvector[j*m + c] += t * C[i*m + c];
+		}
+	}
+	lda_columns(eigenvector, d, m, mu, q, eigenvalue);
+	if (rank)
+		*rank = r;
+	ret = 0;
+
+L_EXIT:
+
+	if (X)
+		free(X);
+	if (G)
+		free(G);
+	if (D)
+		free(D);
+	if (C)
+		free(C);
+	if (H)
+		free(H);
+	if (mu)
+		free(mu);
+	if (Z)
+		free(Z);
+	if (Nk)
+		free(Nk);
+
+	return ret;
+}
+
+typedef struct QDAJOB {
+	INT d;
+	INT q;
+	double reg;
+	double *L;				// class scatters in, factors out
+	const double *P;		// pooled covariance, upper triangle
+	const double *Nk;
+	double *bias;
+	std::atomic<INT> next;
+	std::atomic<INT> status;
+} QDAJOB;
+
+// Factors the classes it claims: the lower triangle of L[c] becomes the
+// Cholesky factor of (1 - reg) * S[c] / (N[c] - 1) + reg * P, read from
+// the upper triangle in place.
+static void qda_worker(QDAJOB *pJob)
+{
+	INT d = pJob->d;
+	INT c, i, j;
+	double *S;
+	double a, g;
+
+	while ((c = pJob->next.fetch_add(1)) < pJob->q){
+		if (pJob->Nk[c] <= 0)
+			continue;
+		S = pJob->L + (INT64)c * d * d;
+		a = (pJob->Nk[c] > 1) ? (1 - pJob->reg) / (pJob->Nk[c] - 1) : 0;
+		for (i = 0; i < d; i++){
+			for (j = 0; j <= i; j++)
+				S[i*d + j] = a * S[j*d + i] + pJob->reg * pJob->P[j*d + i];
+		}
+		if (CholeskyDecomposition(d, S) != 0){
+			pJob->status = -1;
+			continue;
+		}
+		g = 0;
+		for (i = 0; i < d; i++)
+			g += log(S[i*d + i]);
+		pJob->bias[c] = -g;
+	}
+}
+
+// Quadratic discriminant analysis from the per-class scatters the handle
+// already keeps. Each class covariance is shrunk toward the pooled one,
+//   Sigma[c] = (1 - reg) * S[c] / (N[c] - 1) + reg * Sw / (N - q),
+// reg in [0, 1] (0 is plain QDA, 1 shares the LDA covariance), and
+// factored by Cholesky, the classes in parallel. Like LDA_SolveSnapshot
+// it leaves the handle open for more samples. Fails when a covariance is
+// not positive definite; raise reg then.
+INT LDA_SolveQDA(HANDLE hLDA, double reg)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	QDA qda, old;
+	QDA *pQDA;
+	QDAJOB job;
+	ACCUM *part[LDA_MAXPART];
+	double f[LDA_MAXPART];
+	std::thread *worker = NULL;
+	double *P = NULL;
+	double *Nk = NULL;
+	double *t_n = NULL;
+	double *S;
+	double total, dof;
+	INT d, q, c, i, j, p, nPart, nThread;
+	INT ret = -1;
+
+	if (pLDA == NULL || !(reg >= 0 && reg <= 1))
+		return -1;
+	d = pLDA->d;
+	q = pLDA->q;
+
+	// factored aside and exchanged under solLock, so LDA_ClassifyQDA
+	// keeps the previous model until this one is complete
+	memset(&qda, 0, sizeof(qda));
+	pQDA = &qda;
+	pQDA->L = (double *)malloc(sizeof(double) * q * d * d);
+	pQDA->M = (double *)malloc(sizeof(double) * q * d);
+	pQDA->bias = (double *)malloc(sizeof(double) * q);
+	pQDA->logPrior = (double *)malloc(sizeof(double) * q);
+	P = (double *)calloc(d * d, sizeof(double));
+	Nk = (double *)malloc(sizeof(double) * q);
+	t_n = (double *)malloc(sizeof(double) * d);
+	if (pQDA->L == NULL || pQDA->M == NULL || pQDA->bias == NULL || pQDA->logPrior == NULL ||
+		P == NULL || Nk == NULL || t_n == NULL)
+		goto L_EXIT;
+
+	{
+		std::lock_guard<std::mutex> lkBase(*pLDA->baseLock);
+		std::lock_guard<std::mutex> lk(*pLDA->lock);
+		if (pLDA->count == 0)
+			goto L_EXIT;
+		nPart = lda_parts(pLDA, part);
+		for (p = 0; p < nPart; p++)
+			f[p] = exp2(part[p]->t0 - pLDA->t);
+		for (c = 0; c < q; c++)
+			Nk[c] = lda_class(part, nPart, f, pLDA->shift, c, pQDA->L + (INT64)c * d * d, pQDA->M + c * d, t_n);
+	}
+
+	// pooled covariance
+	total = 0;
+	dof = 0;
+	for (c = 0; c < q; c++){
+		total += Nk[c];
+		if (Nk[c] <= 0)
+			continue;
+		dof += Nk[c] - 1;
+		S = pQDA->L + (INT64)c * d * d;
+		for (i = 0; i < d; i++){
+			for (j = i; j < d; j++)
+				P[i*d + j] += S[i*d + j];
+		}
+	}
+	if (dof <= 0)
+		goto L_EXIT;
+	for (i = 0; i < d * d; i++)
+		P[i] /= dof;
+	for (c = 0; c < q; c++){
+		pQDA->bias[c] = -HUGE_VAL;
+		pQDA->logPrior[c] = (Nk[c] > 0) ? log(Nk[c] / total) : -HUGE_VAL;
+	}
+
+	job.d = d;
+	job.q = q;
+	job.reg = reg;
+	job.L = pQDA->L;
+	job.P = P;
+	job.Nk = Nk;
+	job.bias = pQDA->bias;
+	job.next = 0;
+	job.status = 0;
+	nThread = MAX(1, MIN(q, (INT)std::thread::hardware_concurrency()));
+	worker = new std::thread [nThread];
+	for (i = 0; i < nThread; i++)
+		worker[i] = std::thread(qda_worker, &job);
+	for (i = 0; i < nThread; i++)
+		worker[i].join();
+	delete [] worker;
+
+	if (job.status == 0){
+		pQDA->bSolved = TRUE;
+		{
+			std::lock_guard<std::mutex> lk(*pLDA->solLock);
+			old = pLDA->qda;
+			pLDA->qda = qda;
+			qda = old;
+		}
+		ret = 0;
+	}
+
+L_EXIT:
+
+	qda_free(&qda);
+	if (P)
+		free(P);
+	if (Nk)
+		free(Nk);
+	if (t_n)
+		free(t_n);
+
+	return ret;
+}
+
+// Scores n rows against every class of the last LDA_SolveQDA. For each
+// panel of LDA_BLOCK rows the centered panel of every class is solved
+// against its factor at once, its rows being the right-hand sides, so
+// each factor is streamed once per panel. label receives the best class,
+// score (n*q) the score of every class.
+INT LDA_ClassifyQDA(HANDLE hLDA, const double *v, INT n, BOOL bPriors, INT *label, double *score)
+{
+	LDA *pLDA = (LDA *)hLDA;
+	QDA *pQDA;
+	double *Y = NULL;
+	double *g = NULL;
+	const double *x, *m;
+	double *yi, *sr;
+	double best;
+	INT d, q, r, r0, nb, i, c, arg;
+
+	if (pLDA == NULL)
+		return -1;
+	if (v == NULL || n < 0 || (label == NULL && score == NULL))
+		return -1;
+	d = pLDA->d;
+	q = pLDA->q;
+	pQDA = &pLDA->qda;
+
+	Y = (double *)malloc(sizeof(double) * d * LDA_BLOCK);
+	g = (double *)malloc(sizeof(double) * LDA_BLOCK * q);
+	if (Y == NULL || g == NULL){
+		if (Y)
+			free(Y);
+		if (g)
+			free(g);
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> lk(*pLDA->solLock);
+	if (!pQDA->bSolved){
+		free(Y);
+		free(g);
+		return -1;
+	}
+
+	for (r0 = 0; r0 < n; r0 += nb){
+		nb = MIN(LDA_BLOCK, n - r0);
+		for (c = 0; c < q; c++){
+			if (pQDA->bias[c] == -HUGE_VAL){
+				for (r = 0; r < nb; r++)
+					g[r*q + c] = -HUGE_VAL;
+				continue;
+			}
+
+			// Y = (X - m)', d rows of nb
+			m = pQDA->M + c * d;
+			for (r = 0; r < nb; r++){
+				x = v + (INT64)(r0 + r) * d;
+				for (i = 0; i < d; i++)
+					Y[i*nb + r] = x[i] - m[i];
+			}
+			CholeskyForward(d, pQDA->L + (INT64)c * d * d, nb, Y, nb);
+
+			for (r = 0; r < nb; r++)
+				g[r*q + c] = 0;
+			for (i = 0; i < d; i++){
+				yi = Y + i * nb;
+				for (r = 0; r < nb; r++)
+					g[r*q + c] += yi[r] * yi[r];
+			}
+			for (r = 0; r < nb; r++)
+				g[r*q + c] = -0.5 * g[r*q + c] + pQDA->bias[c] + (bPriors ? pQDA->logPrior[c] : 0);
+		}
+
+		for (r = 0; r < nb; r++){
+			sr = g + r * q;
+			best = -HUGE_VAL;
+			arg = 0;
+			for (c = 0; c < q; c++){
+				if (sr[c] > best){
+					best = sr[c];
+					arg = c;
+				}
+			}
+			if (label)
+				label[r0 + r] = arg;
+			if (score)
+				memcpy(score + (INT64)(r0 + r) * q, sr, sizeof(double) * q);
+		}
+	}
+
+	free(Y);
+	free(g);
+
+	return n;
+}
+
+// rows per pass of LDA_AddMulti, and label combinations collected per pass
+#define LDA_MULTI_ROWS		16384
+#define LDA_MULTI_CELLS		64
+
+// Adds the sums of one cell, taken around the shift a, to class k of a
+// handle: with y' = y + (a - K[k]),
+//   S' = S + e*C' + C*e' + N*e*e',  C' = C + N*e,  e = a - K[k]
+static INT lda_add_cell(LDA *pLDA, INT k, const double *a, double N, const double *C, const double *S,
+	INT count, double *e)
+{
+	ACCUM *pAcc;
+	double *s, *K;
+	INT d = pLDA->d;
+	INT i, j;
+
+	std::lock_guard<std::mutex> lk(*pLDA->lock);
+	if (pLDA->bTrained)
+		return -1;
+
+	pAcc = pLDA->acc;
+	K = lda_shift(pLDA, k, a, NULL);
+	for (i = 0; i < d; i++)
+		e[i] = a[i] - K[i];
+	for (i = 0; i < d; i++){
+		s = pAcc->S[k] + i * d;
+		for (j = i; j < d; j++)
+			s[j] += S[i*d + j] + e[i] * C[j] + C[i] * e[j] + N * e[i] * e[j];
+	}
+	for (i = 0; i < d; i++)
+		pAcc->C[k][i] += C[i] + N * e[i];
+	pAcc->N[k] += N;
+	pAcc->count += count;
+	pLDA->count += count;
+
+	return 0;
+}
+
+// Rows of several handles at once, e.g. models over different label
+// columns, one-vs-rest splits or segments of the same data. Row r has the
+// label k[r*nModel + m] in model m, or -1 to stay out of it. Rows are
+// grouped by their combination of labels (a cell): each row is added to
+// one cell accumulator, so its outer product is computed once, and every
+// cell is then added to the class it maps to in each model, O(d*d) per
+// cell and model. With few distinct combinations this costs about one
+// model's ingestion. The handles must share d and must not decay or
+// window; a handle solved meanwhile fails the call part way.
+INT LDA_AddMulti(HANDLE *hLDA, INT nModel, const double *v, const INT *k, INT n)
+{
+	LDA **pModel = (LDA **)hLDA;
+	LDA *pCell = NULL;
+	INT *tuple = NULL;
+	INT *cellOf = NULL;
+	INT *cellRows = NULL;
+	double *e = NULL;
+	const INT *kr;
+	INT d, m, r, r0, c, nCell, cap, run, ret = -1;
+
+	if (pModel == NULL || nModel <= 0 || v == NULL || k == NULL || n < 0)
+		return -1;
+	for (m = 0; m < nModel; m++){
+		if (pModel[m] == NULL || pModel[m]->d != pModel[0]->d)
+			return -1;
+		std::lock_guard<std::mutex> lk(*pModel[m]->lock);
+		if (pModel[m]->bTrained || pModel[m]->rate != 0 || pModel[m]->block != 0)
+			return -1;
+	}
+	for (r = 0; r < n; r++){
+		for (m = 0; m < nModel; m++){
+			if (k[r*nModel + m] < -1 || k[r*nModel + m] >= pModel[m]->q)
+				return -1;
+		}
+	}
+	d = pModel[0]->d;
+
+	// the cells are the classes of a scratch handle
+	cap = MIN(LDA_MULTI_CELLS, d);
+	pCell = (LDA *)LDA_Create(d, cap);
+	tuple = (INT *)malloc(sizeof(INT) * cap * nModel);
+	cellOf = (INT *)malloc(sizeof(INT) * LDA_MULTI_ROWS);
+	cellRows = (INT *)malloc(sizeof(INT) * cap);
+	e = (double *)malloc(sizeof(double) * d);
+	if (pCell == NULL || tuple == NULL || cellOf == NULL || cellRows == NULL || e == NULL)
+		goto L_EXIT;
+	pCell->nThread = pModel[0]->nThread;
+
+	for (r0 = 0; r0 < n; r0 = r){
+		// collect rows until the pass is full or a combination finds no cell
+		nCell = 0;
+		run = r0;
+		for (r = r0; r < n && r - r0 < LDA_MULTI_ROWS; r++){
+			kr = k + (INT64)r * nModel;
+			for (m = 0; m < nModel && kr[m] == -1; m++)
+				;
+			if (m == nModel){
+				// in no model; add the rows before it
+				if (r > run && LDA_AddBatch(pCell, v + (INT64)run * d, cellOf + (run - r0), r - run) < 0)
+					goto L_EXIT;
+				run = r + 1;
+				continue;
+			}
+			for (c = 0; c < nCell && memcmp(tuple + c * nModel, kr, sizeof(INT) * nModel) != 0; c++)
+				;
+			if (c == nCell){
+				if (nCell == cap)
+					break;
+				memcpy(tuple + c * nModel, kr, sizeof(INT) * nModel);
+				cellRows[c] = 0;
+				nCell++;
+			}
+			cellOf[r - r0] = c;
+			cellRows[c]++;
+		}
+		if (r > run && LDA_AddBatch(pCell, v + (INT64)run * d, cellOf + (run - r0), r - run) < 0)
+			goto L_EXIT;
+
+		for (c = 0; c < nCell; c++){
+			for (m = 0; m < nModel; m++){
+				if (tuple[c*nModel + m] == -1)
+					continue;
+				if (lda_add_cell(pModel[m], tuple[c*nModel + m], pCell->shift + c * d, pCell->acc->N[c],
+					pCell->acc->C[c], pCell->acc->S[c], cellRows[c], e) != 0)
+					goto L_EXIT;
+			}
+		}
+
+		acc_clear(pCell->acc, 0);
+		memset(pCell->bShift, 0, sizeof(BOOL) * cap);
+		pCell->count = 0;
+	}
+	ret = n;
+
+L_EXIT:
+
+	if (pCell)
+		LDA_Release(pCell);
+	if (tuple)
+		free(tuple);
+	if (cellOf)
+		free(cellOf);
+	if (cellRows)
+		free(cellRows);
+	if (e)
+		free(e);
+
+	return ret;
+}
+
+typedef struct SOLVEJOB {
+	LDA **pModel;
+	INT nModel;
+	std::atomic<INT> next;
+	std::atomic<INT> status;
+} SOLVEJOB;
+
+static void solve_worker(SOLVEJOB *pJob)
+{
+	INT m;
+
+	while ((m = pJob->next.fetch_add(1)) < pJob->nModel){
+		if (lda_solve(pJob->pModel[m], NULL, NULL, TRUE) != 0)
+			pJob->status = -1;
+	}
+}
+
+// LDA_Solve of nModel handles, the models in parallel. Each handle keeps
+// its solution for LDA_Classify and LDA_SaveModel. Fails if any solve
+// fails; the others are solved regardless.
+INT LDA_SolveMany(HANDLE *hLDA, INT nModel)
+{
+	SOLVEJOB job;
+	std::thread *worker;
+	INT i, nThread;
+
+	if (hLDA == NULL || nModel <= 0)
+		return -1;
+	for (i = 0; i < nModel; i++){
+		if (hLDA[i] == NULL)
+			return -1;
+	}
+
+	job.pModel = (LDA **)hLDA;
+	job.nModel = nModel;
+	job.next = 0;
+	job.status = 0;
+	nThread = MAX(1, MIN(nModel, (INT)std::thread::hardware_concurrency()));
+	worker = new std::thread [nThread];
+	for (i = 0; i < nThread; i++)
+		worker[i] = std::thread(solve_worker, &job);
+	for (i = 0; i < nThread; i++)
+		worker[i].join();
+	delete [] worker;
+
+	return job.status;
+}
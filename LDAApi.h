@@ -7,10 +7,147 @@
 extern "C"{
 #endif
 
+// element types of binary datasets
+#define LDA_FLOAT32		4
+#define LDA_FLOAT64		8
+
+// layouts of LDA_AddMoments
+#define LDA_PACKED		0
+#define LDA_FULL		1
+
+// completion of LDA_SolveAsync, called on the worker thread
+typedef void (*LDA_CALLBACK)(void *user, HANDLE hModel, INT status);
+
+// diagnostics of the last LDA_Solve or LDA_SolveSnapshot on a handle, kept
+// when the solve fails; times in seconds
+typedef struct LDA_STATS {
+	double tGather;			// scatter matrices from the running sums
+	double tQzhes;			// Hessenberg-triangular reduction
+	double tQzit;			// QZ iteration
+	double tQzval;			// eigenvalues
+	double tQzvec;			// eigenvectors
+	double tClassifier;		// scaling and class centroids
+	double tTotal;
+	INT nIter;				// QZ iterations
+	INT nDeflate;			// blocks split off during QZ
+	INT ierr;				// j if QZ gave up seeking the j-th eigenvalue, else 0
+	INT nInfinite;			// eigenvalues with beta at round-off level
+	double rcond;			// reciprocal condition estimate of Sw
+} LDA_STATS;
+
 HANDLE LDA_Create(INT d, INT q);
 INT LDA_Release(HANDLE hLDA);
 INT LDA_Add(HANDLE hLDA, double *v, INT k);
 INT LDA_Solve(HANDLE hLDA, double *eigenvector, double *eigenvalue);
+INT LDA_SolveSnapshot(HANDLE hLDA, double *eigenvector, double *eigenvalue);
+INT LDA_SolveStats(HANDLE hLDA, LDA_STATS *stats);
+INT LDA_SolveUpdate(HANDLE hLDA, INT k, INT iters, double *eigenvector, double *eigenvalue, double *residual);
+INT LDA_SolveMany(HANDLE *hLDA, INT nModel);
+INT LDA_SolveBatch(INT n, INT count, const double *A, const double *B, double *eigenvector, double *eigenvalue);
+INT LDA_SolveAsync(HANDLE hLDA, LDA_CALLBACK callback, void *user);
+INT LDA_SolveWait(HANDLE hLDA);
+HANDLE LDA_AcquireModel(HANDLE hLDA);
+INT LDA_AddBatch(HANDLE hLDA, const double *v, const INT *k, INT n);
+INT LDA_AddBatchF(HANDLE hLDA, const float *v, const INT *k, INT n);
+INT LDA_AddWeighted(HANDLE hLDA, const double *v, const INT *k, const double *weight, INT n);
+INT LDA_AddMoments(HANDLE hLDA, INT k, double n, const double *sum, const double *sxx, INT layout);
+INT LDA_AddMulti(HANDLE *hLDA, INT nModel, const double *v, const INT *k, INT n);
+INT LDA_GetInfo(HANDLE hLDA, INT *d, INT *q);
+INT LDA_SetDecay(HANDLE hLDA, double halfLife);
+INT LDA_SetWindow(HANDLE hLDA, INT window, INT blocks);
+INT LDA_SetThreads(HANDLE hLDA, INT nThread);
+INT LDA_Project(const double *eigenvector, INT d, INT k, const double *v, INT n, double *u);
+INT LDA_SaveModel(HANDLE hLDA, const char *file, INT k);
+INT LDA_CrossValidate(const double *v, const INT *k, INT n, INT d, INT q, INT folds, BOOL bPriors, double *accuracy);
+INT LDA_SolveSubset(HANDLE hLDA, const INT *idx, INT m, double *eigenvector, double *eigenvalue);
+INT LDA_FisherScore(HANDLE hLDA, const INT *idx, INT m, double *score);
+INT LDA_SelectFeatures(HANDLE hLDA, INT m, BOOL bBackward, INT *idx, double *score);
+INT LDA_Shrinkage(HANDLE hLDA, double *lambda, double *rho);
+INT LDA_SolvePath(HANDLE hLDA, const double *lambda, INT nLambda, INT k, double *eigenvector, double *eigenvalue);
+INT LDA_SolveRange(HANDLE hLDA, INT k, double *eigenvector, double *eigenvalue, INT *rank);
+INT LDA_SolveGram(const double *v, const INT *k, INT n, INT d, INT q, INT m,
+	double *eigenvector, double *eigenvalue, INT *rank);
+INT LDA_Classify(HANDLE hLDA, const double *v, INT n, BOOL bPriors, INT *label, double *score);
+INT LDA_SolveQDA(HANDLE hLDA, double reg);
+INT LDA_ClassifyQDA(HANDLE hLDA, const double *v, INT n, BOOL bPriors, INT *label, double *score);
+
+// trained models; LDA_ModelCreate/LDA_ModelWrite take the d*d layout of
+// LDA_Solve and keep its leading k columns, LDA_ModelGet returns them d*k
+HANDLE LDA_LoadModel(const char *file, BOOL bVerify);
+HANDLE LDA_ModelCreate(INT d, INT k, INT q, const double *eigenvector, const double *eigenvalue,
+	const double *mean, const double *count, const double *scale, const double *centroid);
+INT LDA_ModelWrite(const char *file, INT d, INT k, INT q, const double *eigenvector, const double *eigenvalue,
+	const double *mean, const double *count, const double *scale, const double *centroid);
+INT LDA_ModelRetain(HANDLE hModel);
+INT LDA_ModelRelease(HANDLE hModel);
+INT LDA_ModelInfo(HANDLE hModel, INT *d, INT *k, INT *q);
+INT LDA_ModelGet(HANDLE hModel, const double **eigenvector, const double **eigenvalue,
+	const double **mean, const double **count);
+INT LDA_ModelProject(HANDLE hModel, INT k, const double *v, INT n, double *u);
+INT LDA_ModelClassify(HANDLE hModel, const double *v, INT n, BOOL bPriors, INT *label, double *score);
+
+// diagonal LDA with O(q*d) memory; sparse rows are CSR (rowPtr has n+1
+// entries, col/val the nonzeros)
+HANDLE LDA_DiagCreate(INT d, INT q);
+INT LDA_DiagRelease(HANDLE hDiag);
+INT LDA_DiagAdd(HANDLE hDiag, const double *v, const INT *k, INT n);
+INT LDA_DiagAddSparse(HANDLE hDiag, const INT *rowPtr, const INT *col, const double *val, const INT *k, INT n);
+INT LDA_DiagSolve(HANDLE hDiag, double shrink);
+INT LDA_DiagClassify(HANDLE hDiag, const double *v, INT n, BOOL bPriors, INT *label, double *score);
+INT LDA_DiagClassifySparse(HANDLE hDiag, const INT *rowPtr, const INT *col, const double *val, INT n,
+	BOOL bPriors, INT *label, double *score);
+
+// out-of-core LDA, Sw kept in a tiled memory-mapped file; LDA_TiledSolve
+// returns d*k like LDA_SolvePath and spends the handle
+HANDLE LDA_TiledCreate(INT d, INT q, const char *file, INT rows);
+INT LDA_TiledRelease(HANDLE hTiled);
+INT LDA_TiledAdd(HANDLE hTiled, const double *v, const INT *k, INT n);
+INT LDA_TiledSolve(HANDLE hTiled, double lambda, INT k, double *eigenvector, double *eigenvalue);
+
+// hardware performance counters (Linux perf_event_open), user space only,
+// process-wide and off until LDA_PerfEnable, which returns how many of
+// cycles, instructions, LLC misses and FP ops the host exposes (-1 if none
+// can be counted); LDA_PerfGet reports -1 for the others, LDA_PerfReport
+// writes JSON
+#define LDA_PERF_ADD		0	// LDA_Add, LDA_AddBatch, LDA_AddBatchF, LDA_AddWeighted
+#define LDA_PERF_GATHER		1	// scatter matrices of LDA_Solve
+#define LDA_PERF_QZHES		2
+#define LDA_PERF_QZIT		3
+#define LDA_PERF_QZVAL		4
+#define LDA_PERF_QZVEC		5
+#define LDA_PERF_PROJECT	6	// projections, including those of the classifiers
+#define LDA_PERF_PHASES		7
+
+typedef struct LDA_PERF {
+	double calls;
+	double seconds;			// task clock, worker threads included
+	double cycles;
+	double instructions;
+	double llcMisses;
+	double fpOps;			// double-precision flops, Intel only
+} LDA_PERF;
+
+INT LDA_PerfEnable(BOOL bEnable);
+INT LDA_PerfReset(void);
+INT LDA_PerfGet(INT phase, LDA_PERF *perf);
+INT LDA_PerfReport(const char *file);
+
+// binary dataset files
+INT LDA_DatasetConvert(const char *txtFile, const char *binFile, INT d, INT type);
+HANDLE LDA_DatasetOpen(const char *binFile);
+INT LDA_DatasetClose(HANDLE hSet);
+INT LDA_DatasetInfo(HANDLE hSet, INT *d, INT *n, INT *q, INT *type);
+INT LDA_DatasetLabels(HANDLE hSet, double *labels);
+INT LDA_DatasetRows(HANDLE hSet, const void **data, const INT **label);
+INT LDA_DatasetAdd(HANDLE hLDA, HANDLE hSet);
+
+// text input, plain or compressed ("-" reads stdin)
+HANDLE LDA_StreamOpen(const char *file);
+INT LDA_StreamClose(HANDLE hStream);
+INT LDA_StreamRead(HANDLE hStream, double *v, INT len);
+INT LDA_StreamAdd(HANDLE hLDA, HANDLE hStream, INT labelBase);
+INT LDA_StreamProject(HANDLE hStream, HANDLE hModel, INT k, BOOL bLabel,
+	const char *outFile, INT type, INT precision);
 
 #ifdef __cplusplus
 }
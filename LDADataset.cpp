@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "base_types.h"
+#include "FileMap.h"
+#include "LDAApi.h"
+
+#ifndef MIN
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#endif
+
+// Binary dataset layout (little-endian, every section 64-byte aligned):
+//
+//   DATASET_HEADER          256 bytes
+//   features                n rows of d float32/float64 values, row-major
+//   labels                  n int32 class indices into the dictionary
+//   dictionary              q double label values in ascending order
+//
+// A file is mapped read-only and the feature block is handed to the
+// accumulator in place, so ingestion costs one pass over the mapping.
+
+#define DATASET_MAGIC		"LDADATA"
+#define DATASET_VERSION		1
+#define DATASET_ALIGN		64
+#define DATASET_CHUNK		65536
+
+typedef struct DATASET_HEADER {
+	char magic[8];
+	int version;
+	int type;
+	INT64 d;
+	INT64 n;
+	INT64 q;
+	INT64 dataOffset;
+	INT64 labelOffset;
+	INT64 dictOffset;
+	char reserved[192];
+} DATASET_HEADER;
+
+typedef struct DATASET {
+	FILEMAP map;
+	const DATASET_HEADER *pHdr;
+	const char *data;
+	const int *label;
+	const double *dict;
+} DATASET;
+
+static INT64 align_up(INT64 x)
+{
+	return (x + DATASET_ALIGN - 1) & ~(INT64)(DATASET_ALIGN - 1);
+}
+
+// a section of n items of the given size at offset lies past the header,
+// aligned, and inside the file; the length is bounded by division so that
+// no product of header fields can overflow
+static BOOL dataset_section(INT64 size, INT64 offset, INT64 n, INT64 item)
+{
+	if (offset < (INT64)sizeof(DATASET_HEADER) || offset % DATASET_ALIGN != 0 || offset > size)
+		return FALSE;
+	return n <= (size - offset) / item;
+}
+
+static int write_pad(FILE *fp, INT64 offset)
+{
+	static const char zero[DATASET_ALIGN] = {0};
+	INT64 pad = align_up(offset) - offset;
+	if (pad > 0 && fwrite(zero, 1, (size_t)pad, fp) != (size_t)pad)
+		return -1;
+	return 0;
+}
+
+static int _compare_double(const void *a, const void *b)
+{
+	double va = *(const double *)a;
+	double vb = *(const double *)b;
+	if (va < vb)
+		return -1;
+	if (va > vb)
+		return 1;
+	return 0;
+}
+
+INT LDA_DatasetConvert(const char *txtFile, const char *binFile, INT d, INT type)
+{
+	DATASET_HEADER hdr;
+	HANDLE hStream = NULL;
+	FILE *fout = NULL;
+	double *v = NULL;
+	float *vf = NULL;
+	double *raw = NULL;
+	double *dict = NULL;
+	int *label = NULL;
+	INT64 n = 0, cap = 0, q = 0;
+	INT64 i, offset;
+	double *t;
+	INT j;
+
+	if (txtFile == NULL || binFile == NULL || d <= 0)
+		return -1;
+	if (type != LDA_FLOAT32 && type != LDA_FLOAT64)
+		return -1;
+
+	hStream = LDA_StreamOpen(txtFile);
+	fout = fopen(binFile, "wb");
+	v = (double *)malloc(sizeof(double) * (d + 1));
+	vf = (float *)malloc(sizeof(float) * d);
+	if (hStream == NULL || fout == NULL || v == NULL || vf == NULL)
+		goto L_ERROR;
+
+	// header is rewritten once the counts are known
+	memset(&hdr, 0, sizeof(hdr));
+	if (fwrite(&hdr, sizeof(hdr), 1, fout) != 1)
+		goto L_ERROR;
+
+	// features are streamed out as they are parsed; the raw label of every
+	// row is kept until the dictionary is complete
+	while (LDA_StreamRead(hStream, v, d + 1) == d + 1){
+
+		if (n == cap){
+			cap = (cap == 0) ? 4096 : cap * 2;
+			t = (double *)realloc(raw, sizeof(double) * cap);
+			if (t == NULL)
+				goto L_ERROR;
+			raw = t;
+		}
+		raw[n++] = v[d];
+
+		if (type == LDA_FLOAT32){
+			for (j = 0; j < d; j++)
+				vf[j] = (float)v[j];
+			if (fwrite(vf, sizeof(float), d, fout) != (size_t)d)
+				goto L_ERROR;
+		}
+		else {
+			if (fwrite(v, sizeof(double), d, fout) != (size_t)d)
+				goto L_ERROR;
+		}
+	}
+	if (n == 0)
+		goto L_ERROR;
+
+	// dictionary: sorted unique label values
+	dict = (double *)malloc(sizeof(double) * n);
+	label = (int *)malloc(sizeof(int) * DATASET_CHUNK);
+	if (dict == NULL || label == NULL)
+		goto L_ERROR;
+	memcpy(dict, raw, sizeof(double) * n);
+	qsort(dict, (size_t)n, sizeof(double), _compare_double);
+	for (i = 0; i < n; i++){
+		if (q == 0 || dict[q-1] != dict[i])
+			dict[q++] = dict[i];
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+	hdr.version = DATASET_VERSION;
+	hdr.type = type;
+	hdr.d = d;
+	hdr.n = n;
+	hdr.q = q;
+	hdr.dataOffset = sizeof(hdr);
+	offset = hdr.dataOffset + n * d * type;
+	if (write_pad(fout, offset) != 0)
+		goto L_ERROR;
+
+	hdr.labelOffset = align_up(offset);
+	for (i = 0; i < n; i += DATASET_CHUNK){
+		INT64 m = MIN(DATASET_CHUNK, n - i);
+		INT64 r;
+		for (r = 0; r < m; r++){
+			double *p = (double *)bsearch(&raw[i+r], dict, (size_t)q, sizeof(double), _compare_double);
+			label[r] = (int)(p - dict);
+		}
+		if (fwrite(label, sizeof(int), (size_t)m, fout) != (size_t)m)
+			goto L_ERROR;
+	}
+	offset = hdr.labelOffset + n * sizeof(int);
+	if (write_pad(fout, offset) != 0)
+		goto L_ERROR;
+
+	hdr.dictOffset = align_up(offset);
+	if (fwrite(dict, sizeof(double), (size_t)q, fout) != (size_t)q)
+		goto L_ERROR;
+
+	if (fseek(fout, 0L, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, fout) != 1)
+		goto L_ERROR;
+
+	LDA_StreamClose(hStream);
+	hStream = NULL;
+	if (fclose(fout) != 0){
+		fout = NULL;
+		goto L_ERROR;
+	}
+	free(v);
+	free(vf);
+	free(raw);
+	free(dict);
+	free(label);
+
+	return (INT)q;
+
+L_ERROR:
+
+	if (hStream)
+		LDA_StreamClose(hStream);
+	if (fout)
+		fclose(fout);
+	if (v)
+		free(v);
+	if (vf)
+		free(vf);
+	if (raw)
+		free(raw);
+	if (dict)
+		free(dict);
+	if (label)
+		free(label);
+
+	return -1;
+}
+
+HANDLE LDA_DatasetOpen(const char *binFile)
+{
+	DATASET *pSet = NULL;
+	const DATASET_HEADER *pHdr;
+	INT64 size;
+
+	pSet = (DATASET *)malloc(sizeof(*pSet));
+	if (pSet == NULL)
+		return NULL;
+	memset(pSet, 0, sizeof(*pSet));
+
+	if (FileMap_Open(&pSet->map, binFile, FALSE, 0) != 0){
+		free(pSet);
+		return NULL;
+	}
+
+	size = pSet->map.size;
+	pHdr = (const DATASET_HEADER *)pSet->map.base;
+	if (size < (INT64)sizeof(*pHdr) || memcmp(pHdr->magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0)
+		goto L_ERROR;
+	if (pHdr->version != DATASET_VERSION)
+		goto L_ERROR;
+	if (pHdr->type != LDA_FLOAT32 && pHdr->type != LDA_FLOAT64)
+		goto L_ERROR;
+	if (pHdr->d <= 0 || pHdr->n <= 0 || pHdr->q <= 0 ||
+		pHdr->d > 0x7fffffff || pHdr->q > 0x7fffffff)
+		goto L_ERROR;
+	if (!dataset_section(size, pHdr->dataOffset, pHdr->n, pHdr->d * pHdr->type) ||
+		!dataset_section(size, pHdr->labelOffset, pHdr->n, sizeof(int)) ||
+		!dataset_section(size, pHdr->dictOffset, pHdr->q, sizeof(double)))
+		goto L_ERROR;
+
+	pSet->pHdr = pHdr;
+	pSet->data = (const char *)pSet->map.base + pHdr->dataOffset;
+	pSet->label = (const int *)((const char *)pSet->map.base + pHdr->labelOffset);
+	pSet->dict = (const double *)((const char *)pSet->map.base + pHdr->dictOffset);
+
+	return pSet;
+
+L_ERROR:
+
+	FileMap_Close(&pSet->map);
+	free(pSet);
+
+	return NULL;
+}
+
+INT LDA_DatasetClose(HANDLE hSet)
+{
+	DATASET *pSet = (DATASET *)hSet;
+	if (pSet == NULL)
+		return -1;
+	FileMap_Close(&pSet->map);
+	free(pSet);
+	return 0;
+}
+
+INT LDA_DatasetInfo(HANDLE hSet, INT *d, INT *n, INT *q, INT *type)
+{
+	DATASET *pSet = (DATASET *)hSet;
+	if (pSet == NULL)
+		return -1;
+	if (d)
+		*d = (INT)pSet->pHdr->d;
+	if (n)
+		*n = (INT)pSet->pHdr->n;
+	if (q)
+		*q = (INT)pSet->pHdr->q;
+	if (type)
+		*type = pSet->pHdr->type;
+	return 0;
+}
+
+INT LDA_DatasetLabels(HANDLE hSet, double *labels)
+{
+	DATASET *pSet = (DATASET *)hSet;
+	if (pSet == NULL || labels == NULL)
+		return -1;
+	memcpy(labels, pSet->dict, sizeof(double) * (size_t)pSet->pHdr->q);
+	return (INT)pSet->pHdr->q;
+}
+
+INT LDA_DatasetRows(HANDLE hSet, const void **data, const INT **label)
+{
+	DATASET *pSet = (DATASET *)hSet;
+	if (pSet == NULL || sizeof(INT) != sizeof(int))
+		return -1;
+	if (data)
+		*data = pSet->data;
+	if (label)
+		*label = (const INT *)pSet->label;
+	return (INT)pSet->pHdr->n;
+}
+
+INT LDA_DatasetAdd(HANDLE hLDA, HANDLE hSet)
+{
+	DATASET *pSet = (DATASET *)hSet;
+	const DATASET_HEADER *pHdr;
+	const INT *k;
+	INT *t = NULL;
+	INT64 i, r, m;
+	INT d, q, ret = -1;
+
+	if (pSet == NULL)
+		return -1;
+	if (LDA_GetInfo(hLDA, &d, &q) != 0)
+		return -1;
+
+	pHdr = pSet->pHdr;
+	if (pHdr->d != d || pHdr->q > q)
+		return -1;
+
+	if (sizeof(INT) != sizeof(int)){
+		t = (INT *)malloc(sizeof(INT) * DATASET_CHUNK);
+		if (t == NULL)
+			return -1;
+	}
+
+	// chunks keep the label conversion buffer small; the features
+	// themselves are read straight out of the mapping
+	for (i = 0; i < pHdr->n; i += DATASET_CHUNK){
+		m = MIN(DATASET_CHUNK, pHdr->n - i);
+		if (t){
+			for (r = 0; r < m; r++)
+				t[r] = pSet->label[i+r];
+			k = t;
+		}
+		else
+			k = (const INT *)(pSet->label + i);
+
+		if (pHdr->type == LDA_FLOAT64)
+			ret = LDA_AddBatch(hLDA, (const double *)pSet->data + i * d, k, (INT)m);
+		else
+			ret = LDA_AddBatchF(hLDA, (const float *)pSet->data + i * d, k, (INT)m);
+		if (ret < 0)
+			break;
+	}
+
+	if (t)
+		free(t);
+
+	return ret;
+}
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "base_types.h"
+#include "LDAApi.h"
+
+#ifdef _WIN32
+	typedef __int64 INT64;
+#else
+	typedef long long INT64;
+#endif
+
+#ifndef MIN
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a,b)	((a) >= (b) ? (a) : (b))
+#endif
+
+#define DIAG_BLOCK	64
+
+// Diagonal LDA for very large d: the within-class covariance is reduced to
+// its diagonal, so the handle keeps per-class sums and sums of squares
+// only (O(q*d) memory, no d*d matrix) and a sample costs O(nnz) to add.
+// LDA_DiagSolve optionally shrinks the centroids toward the overall mean
+// by soft thresholding (nearest shrunken centroids, Tibshirani et al.),
+// which drops features that do not separate any class.
+//
+// The sums are not shifted: hashed and count features, the intended
+// input, sit near zero, and a shift would make sparse rows dense.
+
+typedef struct DIAG {
+	INT d;
+	INT q;
+	double *S1;			// q*d, per-class sums
+	double *S2;			// q*d, per-class sums of squares
+	double *N;			// q, samples per class
+
+	// classifier of the last LDA_DiagSolve:
+	//   score[c] = -0.5 * sum((x - m_c)^2 * iv) + logPrior[c]
+	//            = x.a[:,c] - 0.5 * sum(x^2 * iv) + bias[c]
+	double *a;			// d*q, m_c .* iv, a feature's q values together
+	double *iv;			// d, inverse pooled variance
+	double *bias;		// q, -0.5 * sum(m_c^2 * iv)
+	double *logPrior;	// q
+	BOOL bSolved;
+} DIAG;
+
+int lda_project(const double *w, int ldw, int d, int k, const double *v, int n, double *u);
+
+static int _compare_double(const void *a, const void *b)
+{
+	double va = *(const double *)a;
+	double vb = *(const double *)b;
+	if (va < vb)
+		return -1;
+	if (va > vb)
+		return 1;
+	return 0;
+}
+
+HANDLE LDA_DiagCreate(INT d, INT q)
+{
+	DIAG *pDiag;
+
+	if (d <= 0 || q <= 0)
+		return NULL;
+
+	pDiag = (DIAG *)calloc(1, sizeof(DIAG));
+	if (pDiag == NULL)
+		return NULL;
+	pDiag->d = d;
+	pDiag->q = q;
+	pDiag->S1 = (double *)calloc((size_t)q * d, sizeof(double));
+	pDiag->S2 = (double *)calloc((size_t)q * d, sizeof(double));
+	pDiag->N = (double *)calloc(q, sizeof(double));
+	pDiag->a = (double *)malloc(sizeof(double) * (size_t)d * q);
+	pDiag->iv = (double *)malloc(sizeof(double) * d);
+	pDiag->bias = (double *)malloc(sizeof(double) * q);
+	pDiag->logPrior = (double *)malloc(sizeof(double) * q);
+	if (pDiag->S1 == NULL || pDiag->S2 == NULL || pDiag->N == NULL || pDiag->a == NULL ||
+		pDiag->iv == NULL || pDiag->bias == NULL || pDiag->logPrior == NULL){
+		LDA_DiagRelease(pDiag);
+		return NULL;
+	}
+
+	return pDiag;
+}
+
+INT LDA_DiagRelease(HANDLE hDiag)
+{
+	DIAG *pDiag = (DIAG *)hDiag;
+
+	if (pDiag == NULL)
+		return -1;
+	if (pDiag->S1)
+		free(pDiag->S1);
+	if (pDiag->S2)
+		free(pDiag->S2);
+	if (pDiag->N)
+		free(pDiag->N);
+	if (pDiag->a)
+		free(pDiag->a);
+	if (pDiag->iv)
+		free(pDiag->iv);
+	if (pDiag->bias)
+		free(pDiag->bias);
+	if (pDiag->logPrior)
+		free(pDiag->logPrior);
+	free(pDiag);
+
+	return 0;
+}
+
+// n dense rows of d values, labels in [0, q)
+INT LDA_DiagAdd(HANDLE hDiag, const double *v, const INT *k, INT n)
+{
+	DIAG *pDiag = (DIAG *)hDiag;
+	const double *x;
+	double *s1, *s2;
+	INT d, r, j;
+
+	if (pDiag == NULL || v == NULL || k == NULL || n < 0)
+		return -1;
+	d = pDiag->d;
+	for (r = 0; r < n; r++){
+		if (k[r] < 0 || k[r] >= pDiag->q)
+			return -1;
+	}
+
+	for (r = 0; r < n; r++){
+		x = v + (INT64)r * d;
+		s1 = pDiag->S1 + (INT64)k[r] * d;
+		s2 = pDiag->S2 + (INT64)k[r] * d;
+		for (j = 0; j < d; j++){
+			s1[j] += x[j];
+			s2[j] += x[j] * x[j];
+		}
+		pDiag->N[k[r]] += 1;
+	}
+
+	return n;
+}
+
+// n sparse rows in CSR form: row r holds val[rowPtr[r]..rowPtr[r+1]-1] at
+// the feature indices col[...]; missing features are zero
+INT LDA_DiagAddSparse(HANDLE hDiag, const INT *rowPtr, const INT *col, const double *val, const INT *k, INT n)
+{
+	DIAG *pDiag = (DIAG *)hDiag;
+	double *s1, *s2;
+	double x;
+	INT d, r, i;
+
+	if (pDiag == NULL || rowPtr == NULL || k == NULL || n < 0)
+		return -1;
+	if (rowPtr[n] > rowPtr[0] && (col == NULL || val == NULL))
+		return -1;
+	d = pDiag->d;
+	for (r = 0; r < n; r++){
+		if (k[r] < 0 || k[r] >= pDiag->q || rowPtr[r+1] < rowPtr[r])
+			return -1;
+		for (i = rowPtr[r]; i < rowPtr[r+1]; i++){
+			if (col[i] < 0 || col[i] >= d)
+				return -1;
+		}
+	}
+
+	for (r = 0; r < n; r++){
+		s1 = pDiag->S1 + (INT64)k[r] * d;
+		s2 = pDiag->S2 + (INT64)k[r] * d;
+		for (i = rowPtr[r]; i < rowPtr[r+1]; i++){
+			x = val[i];
+			s1[col[i]] += x;
+			s2[col[i]] += x * x;
+		}
+		pDiag->N[k[r]] += 1;
+	}
+
+	return n;
+}
+
+// Builds the classifier from the current sums. Every feature is scaled by
+// s[j] + s0, s0 being the median of the nonzero pooled standard
+// deviations, and with shrink > 0 every standardized centroid offset
+//   d[c][j] = (m[c][j] - m[j]) / (w[c] * (s[j] + s0)),  w[c] = sqrt(1/N[c] - 1/N)
+// is soft-thresholded by shrink; shrink = 0 keeps every offset. Returns
+// the number of features that still separate some class, or -1.
+INT LDA_DiagSolve(HANDLE hDiag, double shrink)
+{
+	DIAG *pDiag = (DIAG *)hDiag;
+	double *s = NULL;
+	double *t = NULL;
+	double total, dof, mean, scale, var, sd, s0, w, off;
+	INT d, q, j, c, m, nActive;
+	BOOL bActive;
+
+	if (pDiag == NULL || !(shrink >= 0))
+		return -1;
+	d = pDiag->d;
+	q = pDiag->q;
+
+	total = 0;
+	dof = 0;
+	for (c = 0; c < q; c++){
+		total += pDiag->N[c];
+		if (pDiag->N[c] > 0)
+			dof += pDiag->N[c] - 1;
+	}
+	if (dof <= 0)
+		return -1;
+
+	s = (double *)malloc(sizeof(double) * d);
+	if (s == NULL)
+		return -1;
+
+	// pooled within-class standard deviations
+	for (j = 0; j < d; j++){
+		var = 0;
+		for (c = 0; c < q; c++){
+			if (pDiag->N[c] > 0)
+				var += pDiag->S2[(INT64)c*d + j] - pDiag->S1[(INT64)c*d + j] * pDiag->S1[(INT64)c*d + j] / pDiag->N[c];
+		}
+		s[j] = (var > 0) ? sqrt(var / dof) : 0;
+	}
+
+	// A feature constant within the classes but differing between them
+	// separates them perfectly, yet its var is zero or a cancellation
+	// remnant of the unshifted S1/S2 sums, and 1/var would let it outweigh
+	// every other feature. s0 keeps all iv on the scale of the data.
+	t = (double *)malloc(sizeof(double) * d);
+	if (t == NULL){
+		free(s);
+		return -1;
+	}
+	m = 0;
+	for (j = 0; j < d; j++){
+		if (s[j] > 0)
+			t[m++] = s[j];
+	}
+	s0 = 0;
+	if (m > 0){
+		qsort(t, (size_t)m, sizeof(double), _compare_double);
+		s0 = (m % 2) ? t[m/2] : 0.5 * (t[m/2 - 1] + t[m/2]);
+	}
+	free(t);
+
+	for (c = 0; c < q; c++){
+		pDiag->bias[c] = (pDiag->N[c] > 0) ? 0 : -HUGE_VAL;
+		pDiag->logPrior[c] = (pDiag->N[c] > 0) ? log(pDiag->N[c] / total) : -HUGE_VAL;
+	}
+
+	nActive = 0;
+	for (j = 0; j < d; j++){
+		mean = 0;
+		scale = 0;
+		for (c = 0; c < q; c++){
+			mean += pDiag->S1[(INT64)c*d + j];
+			if (pDiag->N[c] > 0)
+				scale = MAX(scale, fabs(pDiag->S1[(INT64)c*d + j] / pDiag->N[c]));
+		}
+		mean /= total;
+
+		// no feature varies within the classes: fall back to the rounding
+		// noise of the sums; a feature that is zero everywhere is dropped
+		sd = s[j] + s0;
+		if (sd <= 0)
+			sd = sqrt(DBL_EPSILON) * scale;
+		if (sd <= 0){
+			pDiag->iv[j] = 0;
+			for (c = 0; c < q; c++)
+				pDiag->a[(INT64)j*q + c] = 0;
+			continue;
+		}
+		pDiag->iv[j] = 1 / (sd * sd);
+
+		bActive = FALSE;
+		for (c = 0; c < q; c++){
+			if (pDiag->N[c] <= 0){
+				pDiag->a[(INT64)j*q + c] = 0;
+				continue;
+			}
+			off = pDiag->S1[(INT64)c*d + j] / pDiag->N[c] - mean;
+			if (shrink > 0){
+				w = sqrt(MAX(0.0, 1 / pDiag->N[c] - 1 / total)) * sd;
+				off = (off > 0) ? MAX(0.0, off - shrink * w) : MIN(0.0, off + shrink * w);
+			}
+			if (off != 0)
+				bActive = TRUE;
+			off += mean;
+			pDiag->a[(INT64)j*q + c] = off * pDiag->iv[j];
+			pDiag->bias[c] -= 0.5 * off * off * pDiag->iv[j];
+		}
+		if (bActive)
+			nActive++;
+	}
+	pDiag->bSolved = TRUE;
+
+	free(s);
+
+	return nActive;
+}
+
+static void diag_label(const DIAG *pDiag, const double *g, double xx, BOOL bPriors, INT *label, double *score)
+{
+	double best, t;
+	INT c, arg, q = pDiag->q;
+
+	best = -HUGE_VAL;
+	arg = 0;
+	for (c = 0; c < q; c++){
+		t = g[c] - 0.5 * xx + pDiag->bias[c] + (bPriors ? pDiag->logPrior[c] : 0);
+		if (score)
+			score[c] = t;
+		if (t > best){
+			best = t;
+			arg = c;
+		}
+	}
+	if (label)
+		*label = arg;
+}
+
+// Scores n dense rows against the classes of the last LDA_DiagSolve, a
+// block of rows per pass over a. label receives the best class, score
+// (n*q) the score of every class as described at DIAG.
+INT LDA_DiagClassify(HANDLE hDiag, const double *v, INT n, BOOL bPriors, INT *label, double *score)
+{
+	DIAG *pDiag = (DIAG *)hDiag;
+	const double *x;
+	double *g = NULL;
+	double xx;
+	INT d, q, r, r0, nb, j;
+
+	if (pDiag == NULL || !pDiag->bSolved)
+		return -1;
+	if (v == NULL || n < 0 || (label == NULL && score == NULL))
+		return -1;
+	d = pDiag->d;
+	q = pDiag->q;
+
+	g = (double *)malloc(sizeof(double) * DIAG_BLOCK * q);
+	if (g == NULL)
+		return -1;
+
+	for (r0 = 0; r0 < n; r0 += nb){
+		nb = MIN(DIAG_BLOCK, n - r0);
+		lda_project(pDiag->a, q, d, q, v + (INT64)r0 * d, nb, g);
+		for (r = 0; r < nb; r++){
+			x = v + (INT64)(r0 + r) * d;
+			xx = 0;
+			for (j = 0; j < d; j++)
+				xx += x[j] * x[j] * pDiag->iv[j];
+			diag_label(pDiag, g + r * q, xx, bPriors, label ? label + r0 + r : NULL,
+				score ? score + (INT64)(r0 + r) * q : NULL);
+		}
+	}
+
+	free(g);
+
+	return n;
+}
+
+// LDA_DiagClassify for CSR rows (see LDA_DiagAddSparse), O(nnz*q)
+INT LDA_DiagClassifySparse(HANDLE hDiag, const INT *rowPtr, const INT *col, const double *val, INT n,
+	BOOL bPriors, INT *label, double *score)
+{
+	DIAG *pDiag = (DIAG *)hDiag;
+	const double *aj;
+	double *g = NULL;
+	double x, xx;
+	INT d, q, r, i, c;
+
+	if (pDiag == NULL || !pDiag->bSolved)
+		return -1;
+	if (rowPtr == NULL || n < 0 || (label == NULL && score == NULL))
+		return -1;
+	if (rowPtr[n] > rowPtr[0] && (col == NULL || val == NULL))
+		return -1;
+	d = pDiag->d;
+	q = pDiag->q;
+
+	g = (double *)malloc(sizeof(double) * q);
+	if (g == NULL)
+		return -1;
+
+	for (r = 0; r < n; r++){
+		memset(g, 0, sizeof(double) * q);
+		xx = 0;
+		for (i = rowPtr[r]; i < rowPtr[r+1]; i++){
+			if (col[i] < 0 || col[i] >= d){
+				free(g);
+				return -1;
+			}
+			x = val[i];
+			aj = pDiag->a + (INT64)col[i] * q;
+			for (c = 0; c < q; c++)
+				g[c] += x * aj[c];
+			xx += x * x * pDiag->iv[col[i]];
+		}
+		diag_label(pDiag, g, xx, bPriors, label ? label + r : NULL, score ? score + (INT64)r * q : NULL);
+	}
+
+	free(g);
+
+	return n;
+}
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "base_types.h"
+#include "LDAKernel.h"
+
+#ifdef _WIN32
+	typedef __int64 INT64;
+#else
+	typedef long long INT64;
+#endif
+
+// The vector variants must round like the C loops: no contraction of a
+// multiply and an add into one fused instruction, in any variant.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define LDA_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define LDA_TARGET(isa)
+#else
+#include <cpuid.h>
+#define LDA_TARGET(isa)	__attribute__((target(isa)))
+#endif
+#endif
+
+//=============================================================================
+// generic C
+
+static void axpy_generic(INT n, double a, const double *x, double *y)
+{
+	INT i;
+
+	for (i = 0; i < n; i++)
+		y[i] += a * x[i];
+}
+
+static void axpy4_generic(INT n, const double *a, const double *x0, const double *x1, const double *x2,
+	const double *x3, double *y)
+{
+	INT i;
+
+	for (i = 0; i < n; i++)
+		y[i] += a[0] * x0[i] + a[1] * x1[i] + a[2] * x2[i] + a[3] * x3[i];
+}
+
+static void add_generic(INT n, const double *x, double *y)
+{
+	INT i;
+
+	for (i = 0; i < n; i++)
+		y[i] += x[i];
+}
+
+static void project_generic(INT d, INT k, const double *w, INT ldw, const double *x, double *y)
+{
+	const double *wj;
+	double xj;
+	INT i, j;
+
+	for (j = 0; j < d; j++){
+		wj = w + (INT64)j * ldw;
+		xj = x[j];
+		for (i = 0; i < k; i++)
+			y[i] += xj * wj[i];
+	}
+}
+
+#ifdef LDA_X86
+
+//=============================================================================
+// AVX2, 4 doubles per register
+
+LDA_TARGET("avx2")
+static void axpy_avx2(INT n, double a, const double *x, double *y)
+{
+	__m256d va = _mm256_set1_pd(a);
+	INT i;
+
+	for (i = 0; i + 8 <= n; i += 8){
+		_mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_mul_pd(va, _mm256_loadu_pd(x + i))));
+		_mm256_storeu_pd(y + i + 4,
+			_mm256_add_pd(_mm256_loadu_pd(y + i + 4), _mm256_mul_pd(va, _mm256_loadu_pd(x + i + 4))));
+	}
+	for (; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_mul_pd(va, _mm256_loadu_pd(x + i))));
+	for (; i < n; i++)
+		y[i] += a * x[i];
+}
+
+LDA_TARGET("avx2")
+static void axpy4_avx2(INT n, const double *a, const double *x0, const double *x1, const double *x2,
+	const double *x3, double *y)
+{
+	__m256d a0 = _mm256_set1_pd(a[0]);
+	__m256d a1 = _mm256_set1_pd(a[1]);
+	__m256d a2 = _mm256_set1_pd(a[2]);
+	__m256d a3 = _mm256_set1_pd(a[3]);
+	__m256d s;
+	INT i;
+
+	for (i = 0; i + 4 <= n; i += 4){
+		s = _mm256_mul_pd(a0, _mm256_loadu_pd(x0 + i));
+		s = _mm256_add_pd(s, _mm256_mul_pd(a1, _mm256_loadu_pd(x1 + i)));
+		s = _mm256_add_pd(s, _mm256_mul_pd(a2, _mm256_loadu_pd(x2 + i)));
+		s = _mm256_add_pd(s, _mm256_mul_pd(a3, _mm256_loadu_pd(x3 + i)));
+		_mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), s));
+	}
+	for (; i < n; i++)
+		y[i] += a[0] * x0[i] + a[1] * x1[i] + a[2] * x2[i] + a[3] * x3[i];
+}
+
+LDA_TARGET("avx2")
+static void add_avx2(INT n, const double *x, double *y)
+{
+	INT i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_loadu_pd(x + i)));
+	for (; i < n; i++)
+		y[i] += x[i];
+}
+
+// y is held in registers across all d rows, 16 columns at a time
+LDA_TARGET("avx2")
+static void project_avx2(INT d, INT k, const double *w, INT ldw, const double *x, double *y)
+{
+	__m256d y0, y1, y2, y3, xj;
+	const double *wj;
+	INT i, j;
+
+	for (i = 0; i + 16 <= k; i += 16){
+		y0 = _mm256_loadu_pd(y + i);
+		y1 = _mm256_loadu_pd(y + i + 4);
+		y2 = _mm256_loadu_pd(y + i + 8);
+		y3 = _mm256_loadu_pd(y + i + 12);
+		for (j = 0; j < d; j++){
+			wj = w + (INT64)j * ldw + i;
+			xj = _mm256_set1_pd(x[j]);
+			y0 = _mm256_add_pd(y0, _mm256_mul_pd(xj, _mm256_loadu_pd(wj)));
+			y1 = _mm256_add_pd(y1, _mm256_mul_pd(xj, _mm256_loadu_pd(wj + 4)));
+			y2 = _mm256_add_pd(y2, _mm256_mul_pd(xj, _mm256_loadu_pd(wj + 8)));
+			y3 = _mm256_add_pd(y3, _mm256_mul_pd(xj, _mm256_loadu_pd(wj + 12)));
+		}
+		_mm256_storeu_pd(y + i, y0);
+		_mm256_storeu_pd(y + i + 4, y1);
+		_mm256_storeu_pd(y + i + 8, y2);
+		_mm256_storeu_pd(y + i + 12, y3);
+	}
+	for (; i + 4 <= k; i += 4){
+		y0 = _mm256_loadu_pd(y + i);
+		for (j = 0; j < d; j++)
+			y0 = _mm256_add_pd(y0, _mm256_mul_pd(_mm256_set1_pd(x[j]), _mm256_loadu_pd(w + (INT64)j * ldw + i)));
+		_mm256_storeu_pd(y + i, y0);
+	}
+	if (i < k)
+		project_generic(d, k - i, w + i, ldw, x, y + i);
+}
+
+//=============================================================================
+// AVX-512, 8 doubles per register, masked tails
+
+LDA_TARGET("avx512f")
+static void axpy_avx512(INT n, double a, const double *x, double *y)
+{
+	__m512d va = _mm512_set1_pd(a);
+	__mmask8 m;
+	INT i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm512_storeu_pd(y + i, _mm512_add_pd(_mm512_loadu_pd(y + i), _mm512_mul_pd(va, _mm512_loadu_pd(x + i))));
+	if (i < n){
+		m = (__mmask8)((1u << (n - i)) - 1);
+		_mm512_mask_storeu_pd(y + i, m, _mm512_add_pd(_mm512_maskz_loadu_pd(m, y + i),
+			_mm512_mul_pd(va, _mm512_maskz_loadu_pd(m, x + i))));
+	}
+}
+
+LDA_TARGET("avx512f")
+static void axpy4_avx512(INT n, const double *a, const double *x0, const double *x1, const double *x2,
+	const double *x3, double *y)
+{
+	__m512d a0 = _mm512_set1_pd(a[0]);
+	__m512d a1 = _mm512_set1_pd(a[1]);
+	__m512d a2 = _mm512_set1_pd(a[2]);
+	__m512d a3 = _mm512_set1_pd(a[3]);
+	__m512d s;
+	__mmask8 m;
+	INT i;
+
+	for (i = 0; i < n; i += 8){
+		m = (n - i >= 8) ? (__mmask8)0xff : (__mmask8)((1u << (n - i)) - 1);
+		s = _mm512_mul_pd(a0, _mm512_maskz_loadu_pd(m, x0 + i));
+		s = _mm512_add_pd(s, _mm512_mul_pd(a1, _mm512_maskz_loadu_pd(m, x1 + i)));
+		s = _mm512_add_pd(s, _mm512_mul_pd(a2, _mm512_maskz_loadu_pd(m, x2 + i)));
+		s = _mm512_add_pd(s, _mm512_mul_pd(a3, _mm512_maskz_loadu_pd(m, x3 + i)));
+		_mm512_mask_storeu_pd(y + i, m, _mm512_add_pd(_mm512_maskz_loadu_pd(m, y + i), s));
+	}
+}
+
+LDA_TARGET("avx512f")
+static void add_avx512(INT n, const double *x, double *y)
+{
+	__mmask8 m;
+	INT i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm512_storeu_pd(y + i, _mm512_add_pd(_mm512_loadu_pd(y + i), _mm512_loadu_pd(x + i)));
+	if (i < n){
+		m = (__mmask8)((1u << (n - i)) - 1);
+		_mm512_mask_storeu_pd(y + i, m, _mm512_add_pd(_mm512_maskz_loadu_pd(m, y + i), _mm512_maskz_loadu_pd(m, x + i)));
+	}
+}
+
+LDA_TARGET("avx512f")
+static void project_avx512(INT d, INT k, const double *w, INT ldw, const double *x, double *y)
+{
+	__m512d y0, y1, xj;
+	const double *wj;
+	__mmask8 m;
+	INT i, j;
+
+	for (i = 0; i + 16 <= k; i += 16){
+		y0 = _mm512_loadu_pd(y + i);
+		y1 = _mm512_loadu_pd(y + i + 8);
+		for (j = 0; j < d; j++){
+			wj = w + (INT64)j * ldw + i;
+			xj = _mm512_set1_pd(x[j]);
+			y0 = _mm512_add_pd(y0, _mm512_mul_pd(xj, _mm512_loadu_pd(wj)));
+			y1 = _mm512_add_pd(y1, _mm512_mul_pd(xj, _mm512_loadu_pd(wj + 8)));
+		}
+		_mm512_storeu_pd(y + i, y0);
+		_mm512_storeu_pd(y + i + 8, y1);
+	}
+	for (; i < k; i += 8){
+		m = (k - i >= 8) ? (__mmask8)0xff : (__mmask8)((1u << (k - i)) - 1);
+		y0 = _mm512_maskz_loadu_pd(m, y + i);
+		for (j = 0; j < d; j++)
+			y0 = _mm512_add_pd(y0, _mm512_mul_pd(_mm512_set1_pd(x[j]), _mm512_maskz_loadu_pd(m, w + (INT64)j * ldw + i)));
+		_mm512_mask_storeu_pd(y + i, m, y0);
+	}
+}
+
+//=============================================================================
+// detection
+
+static void lda_cpuid(unsigned leaf, unsigned sub, unsigned *r)
+{
+#if defined(_MSC_VER)
+	int t[4];
+	__cpuidex(t, (int)leaf, (int)sub);
+	r[0] = t[0]; r[1] = t[1]; r[2] = t[2]; r[3] = t[3];
+#else
+	if (!__get_cpuid_count(leaf, sub, &r[0], &r[1], &r[2], &r[3]))
+		r[0] = r[1] = r[2] = r[3] = 0;
+#endif
+}
+
+// Register state the OS saves on a context switch (XCR0)
+static unsigned long long lda_xcr0(void)
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+	__asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+// 0 generic, 1 AVX2, 2 AVX-512
+static int lda_cpu_level(void)
+{
+	unsigned r[4];
+	unsigned long long xcr0;
+	int level = 0;
+
+	lda_cpuid(0, 0, r);
+	if (r[0] < 7)
+		return 0;
+	lda_cpuid(1, 0, r);
+	// OSXSAVE and AVX
+	if ((r[2] & (1u << 27)) == 0 || (r[2] & (1u << 28)) == 0)
+		return 0;
+	xcr0 = lda_xcr0();
+	lda_cpuid(7, 0, r);
+	// XMM and YMM state
+	if ((xcr0 & 0x6) == 0x6 && (r[1] & (1u << 5)))
+		level = 1;
+	// plus opmask and ZMM state
+	if (level == 1 && (xcr0 & 0xe6) == 0xe6 && (r[1] & (1u << 16)))
+		level = 2;
+	return level;
+}
+
+#endif	// LDA_X86
+
+static const LDAKERNEL kernel_generic = { "generic", axpy_generic, axpy4_generic, add_generic, project_generic };
+#ifdef LDA_X86
+static const LDAKERNEL kernel_avx2 = { "avx2", axpy_avx2, axpy4_avx2, add_avx2, project_avx2 };
+static const LDAKERNEL kernel_avx512 = { "avx512", axpy_avx512, axpy4_avx512, add_avx512, project_avx512 };
+#endif
+
+static const LDAKERNEL *lda_kernel_select(void)
+{
+	const char *env = getenv("LDA_KERNEL");
+	int level = 0;
+	int cap = 2;
+
+	if (env && strcmp(env, "generic") == 0)
+		cap = 0;
+	else if (env && strcmp(env, "avx2") == 0)
+		cap = 1;
+
+#ifdef LDA_X86
+	level = lda_cpu_level();
+	if (level > cap)
+		level = cap;
+	if (level == 2)
+		return &kernel_avx512;
+	if (level == 1)
+		return &kernel_avx2;
+#endif
+	(void)level;
+	return &kernel_generic;
+}
+
+// Kernels for this CPU, chosen once
+const LDAKERNEL *lda_kernel(void)
+{
+	static const LDAKERNEL *pKernel = lda_kernel_select();
+
+	return pKernel;
+}
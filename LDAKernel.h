@@ -0,0 +1,31 @@
+#ifndef __LDAKernel_h__
+#define __LDAKernel_h__
+
+#include "base_types.h"
+
+// Inner loops of accumulation and projection, bound at first use to the
+// widest variant the CPU and OS support (AVX-512, AVX2 or generic C). The
+// environment variable LDA_KERNEL (generic, avx2 or avx512) caps the
+// choice for testing. The kernels are elementwise and keep the operation
+// order of the C loops, without fused multiply-add, so every variant
+// produces the same bits.
+typedef struct LDAKERNEL {
+	const char *name;
+
+	// y += a * x
+	void (*axpy)(INT n, double a, const double *x, double *y);
+
+	// y += a[0]*x0 + a[1]*x1 + a[2]*x2 + a[3]*x3, summed left to right
+	void (*axpy4)(INT n, const double *a, const double *x0, const double *x1, const double *x2,
+		const double *x3, double *y);
+
+	// y += x
+	void (*add)(INT n, const double *x, double *y);
+
+	// y[0..k-1] += sum_j x[j] * w[j*ldw + 0..k-1], j ascending
+	void (*project)(INT d, INT k, const double *w, INT ldw, const double *x, double *y);
+} LDAKERNEL;
+
+const LDAKERNEL *lda_kernel(void);
+
+#endif	//__LDAKernel_h__
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include "base_types.h"
+#include "FileMap.h"
+#include "LDAApi.h"
+
+// Model file layout (little-endian, every section 64-byte aligned):
+//
+//   MODEL_HEADER            256 bytes
+//   eigenvector             d rows of k doubles (column i is the i-th
+//                           discriminant, same order as LDA_Solve)
+//   eigenvalue              k doubles
+//   mean                    q rows of d doubles, the class means
+//   count                   q doubles, samples per class
+//   scale                   k doubles, eigenvector scale to unit
+//                           within-class variance (optional)
+//   centroid                q rows of k doubles, class means in the scaled
+//                           discriminant space (optional)
+//
+// The checksum covers the whole image, including the header with its
+// checksum field zeroed. Every section starts past the header on a 64-byte
+// boundary. A model is used in place from the mapping, so every process
+// serving the same file shares one page-cached copy. Models built in
+// memory use the same image.
+
+#define MODEL_MAGIC			"LDAMODL"
+#define MODEL_VERSION		2
+#define MODEL_ALIGN			64
+
+typedef struct MODEL_HEADER {
+	char magic[8];
+	int version;
+	int reserved0;
+	INT64 d;
+	INT64 k;
+	INT64 q;
+	INT64 eigenvectorOffset;
+	INT64 eigenvalueOffset;
+	INT64 meanOffset;
+	INT64 countOffset;
+	INT64 size;
+	unsigned long long checksum;
+	INT64 scaleOffset;			// 0 when there is no classifier
+	INT64 centroidOffset;
+	char reserved[152];
+} MODEL_HEADER;
+
+typedef struct MODEL {
+	FILEMAP map;
+	char *image;			// heap image when not mapped
+	const MODEL_HEADER *pHdr;
+	const double *eigenvector;
+	const double *eigenvalue;
+	const double *mean;
+	const double *count;
+	const double *scale;
+	const double *centroid;
+	std::atomic<double *> logPrior;	// built on first use, models are shared
+	std::atomic<INT> refs;	// freed by the last LDA_ModelRelease
+} MODEL;
+
+int lda_project(const double *w, int ldw, int d, int k, const double *v, int n, double *u);
+int lda_classify(const double *w, int ldw, int d, int k, const double *scale, const double *centroid, int q,
+	const double *logPrior, const double *v, int n, INT *label, double *score);
+
+static INT64 align_up(INT64 x)
+{
+	return (x + MODEL_ALIGN - 1) & ~(INT64)(MODEL_ALIGN - 1);
+}
+
+// FNV-1a over 64-bit words, continuing from h; the image is always a
+// multiple of 8 bytes
+static unsigned long long checksum(unsigned long long h, const void *p, INT64 size)
+{
+	const unsigned long long *w = (const unsigned long long *)p;
+	INT64 i, n = size / 8;
+
+	for (i = 0; i < n; i++){
+		h ^= w[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// checksum of the size-byte image at base, as stored in its header
+static unsigned long long model_checksum(const char *base, INT64 size)
+{
+	MODEL_HEADER hdr;
+	unsigned long long h = 14695981039346656037ULL;
+
+	memcpy(&hdr, base, sizeof(hdr));
+	hdr.checksum = 0;
+	h = checksum(h, &hdr, sizeof(hdr));
+	return checksum(h, base + sizeof(hdr), size - sizeof(hdr));
+}
+
+// a section of a*b doubles at offset lies past the header, aligned, and
+// inside the image; the lengths are bounded by division so that no
+// product of header fields can overflow
+static BOOL model_section(const MODEL_HEADER *pHdr, INT64 offset, INT64 a, INT64 b)
+{
+	INT64 room;
+
+	if (offset < (INT64)sizeof(*pHdr) || offset % MODEL_ALIGN != 0 || offset > pHdr->size)
+		return FALSE;
+	room = (pHdr->size - offset) / (INT64)sizeof(double);
+	return a <= room / b;
+}
+
+// eigenvector is d*d with the discriminants in its leading k columns
+static char *model_image(INT d, INT k, INT q, const double *eigenvector, const double *eigenvalue,
+	const double *mean, const double *count, const double *scale, const double *centroid, INT64 *pSize)
+{
+	MODEL_HEADER hdr;
+	char *image;
+	double *w;
+	INT i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+	hdr.version = MODEL_VERSION;
+	hdr.d = d;
+	hdr.k = k;
+	hdr.q = q;
+	hdr.eigenvectorOffset = sizeof(hdr);
+	hdr.eigenvalueOffset = align_up(hdr.eigenvectorOffset + (INT64)d * k * sizeof(double));
+	hdr.meanOffset = align_up(hdr.eigenvalueOffset + (INT64)k * sizeof(double));
+	hdr.countOffset = align_up(hdr.meanOffset + (INT64)q * d * sizeof(double));
+	hdr.size = align_up(hdr.countOffset + (INT64)q * sizeof(double));
+	if (scale && centroid){
+		hdr.scaleOffset = hdr.size;
+		hdr.centroidOffset = align_up(hdr.scaleOffset + (INT64)k * sizeof(double));
+		hdr.size = align_up(hdr.centroidOffset + (INT64)q * k * sizeof(double));
+	}
+
+	image = (char *)calloc((size_t)hdr.size, 1);
+	if (image == NULL)
+		return NULL;
+
+	w = (double *)(image + hdr.eigenvectorOffset);
+	for (i = 0; i < d; i++)
+		memcpy(w + (INT64)i * k, eigenvector + (INT64)i * d, sizeof(double) * k);
+	memcpy(image + hdr.eigenvalueOffset, eigenvalue, sizeof(double) * k);
+	if (mean)
+		memcpy(image + hdr.meanOffset, mean, sizeof(double) * q * d);
+	if (count)
+		memcpy(image + hdr.countOffset, count, sizeof(double) * q);
+	if (scale && centroid){
+		memcpy(image + hdr.scaleOffset, scale, sizeof(double) * k);
+		memcpy(image + hdr.centroidOffset, centroid, sizeof(double) * q * k);
+	}
+
+	memcpy(image, &hdr, sizeof(hdr));
+	hdr.checksum = model_checksum(image, hdr.size);
+	memcpy(image, &hdr, sizeof(hdr));
+
+	*pSize = hdr.size;
+	return image;
+}
+
+static MODEL *model_attach(MODEL *pModel, const char *base, INT64 size, BOOL bVerify)
+{
+	const MODEL_HEADER *pHdr = (const MODEL_HEADER *)base;
+
+	if (size < (INT64)sizeof(*pHdr) || memcmp(pHdr->magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0)
+		return NULL;
+	if (pHdr->version != MODEL_VERSION)
+		return NULL;
+	if (pHdr->size < (INT64)sizeof(*pHdr) || pHdr->size > size || pHdr->size % 8 != 0)
+		return NULL;
+	if (pHdr->d <= 0 || pHdr->k <= 0 || pHdr->k > pHdr->d || pHdr->q <= 0 ||
+		pHdr->d > 0x7fffffff || pHdr->q > 0x7fffffff)
+		return NULL;
+	if (!model_section(pHdr, pHdr->eigenvectorOffset, pHdr->d, pHdr->k) ||
+		!model_section(pHdr, pHdr->eigenvalueOffset, pHdr->k, 1) ||
+		!model_section(pHdr, pHdr->meanOffset, pHdr->q, pHdr->d) ||
+		!model_section(pHdr, pHdr->countOffset, pHdr->q, 1))
+		return NULL;
+	if (pHdr->centroidOffset != 0 &&
+		(!model_section(pHdr, pHdr->scaleOffset, pHdr->k, 1) ||
+		!model_section(pHdr, pHdr->centroidOffset, pHdr->q, pHdr->k)))
+		return NULL;
+	if (bVerify && model_checksum(base, pHdr->size) != pHdr->checksum)
+		return NULL;
+
+	pModel->pHdr = pHdr;
+	pModel->eigenvector = (const double *)(base + pHdr->eigenvectorOffset);
+	pModel->eigenvalue = (const double *)(base + pHdr->eigenvalueOffset);
+	pModel->mean = (const double *)(base + pHdr->meanOffset);
+	pModel->count = (const double *)(base + pHdr->countOffset);
+	if (pHdr->centroidOffset != 0){
+		pModel->scale = (const double *)(base + pHdr->scaleOffset);
+		pModel->centroid = (const double *)(base + pHdr->centroidOffset);
+	}
+	return pModel;
+}
+
+INT LDA_ModelWrite(const char *file, INT d, INT k, INT q, const double *eigenvector, const double *eigenvalue,
+	const double *mean, const double *count, const double *scale, const double *centroid)
+{
+	FILE *fp = NULL;
+	char *image = NULL;
+	INT64 size;
+	INT ret = 0;
+
+	if (file == NULL || eigenvector == NULL || eigenvalue == NULL)
+		return -1;
+	if (d <= 0 || k <= 0 || k > d || q <= 0)
+		return -1;
+
+	image = model_image(d, k, q, eigenvector, eigenvalue, mean, count, scale, centroid, &size);
+	if (image == NULL)
+		return -1;
+
+	fp = fopen(file, "wb");
+	if (fp == NULL){
+		free(image);
+		return -1;
+	}
+	if (fwrite(image, 1, (size_t)size, fp) != (size_t)size)
+		ret = -1;
+	if (fclose(fp) != 0)
+		ret = -1;
+
+	free(image);
+
+	return ret;
+}
+
+HANDLE LDA_ModelCreate(INT d, INT k, INT q, const double *eigenvector, const double *eigenvalue,
+	const double *mean, const double *count, const double *scale, const double *centroid)
+{
+	MODEL *pModel = NULL;
+	INT64 size;
+
+	if (eigenvector == NULL || eigenvalue == NULL)
+		return NULL;
+	if (d <= 0 || k <= 0 || k > d || q <= 0)
+		return NULL;
+
+	pModel = new MODEL();
+	pModel->refs = 1;
+
+	pModel->image = model_image(d, k, q, eigenvector, eigenvalue, mean, count, scale, centroid, &size);
+	if (pModel->image == NULL || model_attach(pModel, pModel->image, size, FALSE) == NULL){
+		LDA_ModelRelease(pModel);
+		return NULL;
+	}
+
+	return pModel;
+}
+
+HANDLE LDA_LoadModel(const char *file, BOOL bVerify)
+{
+	MODEL *pModel = NULL;
+
+	pModel = new MODEL();
+	pModel->refs = 1;
+
+	if (FileMap_Open(&pModel->map, file, FALSE, 0) != 0){
+		delete pModel;
+		return NULL;
+	}
+	if (model_attach(pModel, (const char *)pModel->map.base, pModel->map.size, bVerify) == NULL){
+		LDA_ModelRelease(pModel);
+		return NULL;
+	}
+
+	return pModel;
+}
+
+INT LDA_ModelRetain(HANDLE hModel)
+{
+	MODEL *pModel = (MODEL *)hModel;
+	if (pModel == NULL)
+		return -1;
+	return pModel->refs.fetch_add(1) + 1;
+}
+
+INT LDA_ModelRelease(HANDLE hModel)
+{
+	MODEL *pModel = (MODEL *)hModel;
+	if (pModel == NULL)
+		return -1;
+	if (pModel->refs.fetch_sub(1) != 1)
+		return 0;
+	if (pModel->map.base)
+		FileMap_Close(&pModel->map);
+	if (pModel->image)
+		free(pModel->image);
+	if (pModel->logPrior.load())
+		free(pModel->logPrior.load());
+	delete pModel;
+	return 0;
+}
+
+INT LDA_ModelInfo(HANDLE hModel, INT *d, INT *k, INT *q)
+{
+	MODEL *pModel = (MODEL *)hModel;
+	if (pModel == NULL)
+		return -1;
+	if (d)
+		*d = (INT)pModel->pHdr->d;
+	if (k)
+		*k = (INT)pModel->pHdr->k;
+	if (q)
+		*q = (INT)pModel->pHdr->q;
+	return 0;
+}
+
+INT LDA_ModelGet(HANDLE hModel, const double **eigenvector, const double **eigenvalue,
+	const double **mean, const double **count)
+{
+	MODEL *pModel = (MODEL *)hModel;
+	if (pModel == NULL)
+		return -1;
+	if (eigenvector)
+		*eigenvector = pModel->eigenvector;
+	if (eigenvalue)
+		*eigenvalue = pModel->eigenvalue;
+	if (mean)
+		*mean = pModel->mean;
+	if (count)
+		*count = pModel->count;
+	return 0;
+}
+
+INT LDA_ModelProject(HANDLE hModel, INT k, const double *v, INT n, double *u)
+{
+	MODEL *pModel = (MODEL *)hModel;
+	INT d;
+
+	if (pModel == NULL || v == NULL || u == NULL || v == u || n < 0)
+		return -1;
+	d = (INT)pModel->pHdr->d;
+	if (k <= 0 || k > pModel->pHdr->k)
+		return -1;
+
+	return lda_project(pModel->eigenvector, (int)pModel->pHdr->k, d, k, v, n, u);
+}
+
+INT LDA_ModelClassify(HANDLE hModel, const double *v, INT n, BOOL bPriors, INT *label, double *score)
+{
+	MODEL *pModel = (MODEL *)hModel;
+	const MODEL_HEADER *pHdr;
+	double *logPrior = NULL;
+	double *expected = NULL;
+	double total = 0;
+	INT i;
+
+	if (pModel == NULL || pModel->centroid == NULL)
+		return -1;
+	if (v == NULL || n < 0 || (label == NULL && score == NULL))
+		return -1;
+	pHdr = pModel->pHdr;
+
+	// priors are derived from the stored class counts on first use; when
+	// two threads race, the loser's copy is dropped
+	if (bPriors){
+		logPrior = pModel->logPrior.load();
+		if (logPrior == NULL){
+			logPrior = (double *)malloc(sizeof(double) * pHdr->q);
+			if (logPrior == NULL)
+				return -1;
+			for (i = 0; i < pHdr->q; i++)
+				total += pModel->count[i];
+			for (i = 0; i < pHdr->q; i++)
+				logPrior[i] = (pModel->count[i] > 0) ? log(pModel->count[i] / total) : -HUGE_VAL;
+			if (!pModel->logPrior.compare_exchange_strong(expected, logPrior)){
+				free(logPrior);
+				logPrior = expected;
+			}
+		}
+	}
+
+	return lda_classify(pModel->eigenvector, (int)pHdr->k, (int)pHdr->d, (int)pHdr->k, pModel->scale,
+		pModel->centroid, (int)pHdr->q, logPrior, v, n, label, score);
+}
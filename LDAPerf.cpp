@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <atomic>
+#include "base_types.h"
+#include "LDAApi.h"
+#include "LDAPerf.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#endif
+
+// LDAPERFMARK slots
+#define EV_CLOCK	0
+#define EV_CYCLES	1
+#define EV_INSTR	2
+#define EV_LLC		3
+#define EV_FP		4	// scalar, 128, 256 and 512-bit packed doubles
+
+// what a phase has counted so far; fp sums the four widths weighted by
+// their doubles per instruction
+typedef struct PERFPHASE {
+	double calls;
+	double value[EV_FP + 1];
+} PERFPHASE;
+
+static const char *s_phaseName[LDA_PERF_PHASES] = {
+	"add", "gather", "qzhes", "qzit", "qzval", "qzvec", "project"
+};
+static const double s_fpWidth[4] = { 1, 2, 4, 8 };
+
+static std::atomic<bool> s_bOn(false);
+static std::mutex s_lock;
+static PERFPHASE s_phase[LDA_PERF_PHASES];
+static BOOL s_bAvail[EV_FP + 1];		// set by LDA_PerfEnable
+
+//=============================================================================
+// counters of the calling thread
+
+#ifdef __linux__
+
+static int perf_open(unsigned int type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.inherit = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// FP_ARITH_INST_RETIRED (event 0xc7) has no generic perf name; its
+// double-precision umasks are raw Intel encodings
+static BOOL perf_intel(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(0, &a, &b, &c, &d))
+		return FALSE;
+	return b == 0x756e6547 && d == 0x49656e69 && c == 0x6c65746e;	// "GenuineIntel"
+#else
+	return FALSE;
+#endif
+}
+
+static void perf_open_all(int *fd)
+{
+	static const unsigned long long umask[4] = { 0x01, 0x04, 0x10, 0x40 };
+	INT i;
+
+	fd[EV_CLOCK] = perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+	fd[EV_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	fd[EV_INSTR] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	fd[EV_LLC] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	for (i = 0; i < 4; i++)
+		fd[EV_FP + i] = perf_intel() ? perf_open(PERF_TYPE_RAW, (umask[i] << 8) | 0xc7) : -1;
+}
+
+static BOOL perf_read(int fd, double *value, double *enabled, double *running)
+{
+	unsigned long long buf[3];
+
+	if (fd < 0 || read(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf))
+		return FALSE;
+	*value = (double)buf[0];
+	*enabled = (double)buf[1];
+	*running = (double)buf[2];
+	return TRUE;
+}
+
+static void perf_close(int fd)
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+#else
+
+static void perf_open_all(int *fd)
+{
+	INT i;
+
+	for (i = 0; i < LDA_PERF_EVENTS; i++)
+		fd[i] = -1;
+}
+
+static BOOL perf_read(int fd, double *value, double *enabled, double *running)
+{
+	return FALSE;
+}
+
+static void perf_close(int fd)
+{
+}
+
+#endif
+
+// Counters are opened on a thread the first time it enters a phase with
+// profiling on, and inherited by the threads it starts afterwards.
+struct PERFTHREAD {
+	int fd[LDA_PERF_EVENTS];
+	BOOL bOpen;
+
+	PERFTHREAD() : bOpen(FALSE) {}
+	~PERFTHREAD()
+	{
+		INT i;
+
+		if (bOpen){
+			for (i = 0; i < LDA_PERF_EVENTS; i++)
+				perf_close(fd[i]);
+		}
+	}
+};
+
+static thread_local PERFTHREAD t_perf;
+
+static int *perf_thread(void)
+{
+	if (!t_perf.bOpen){
+		perf_open_all(t_perf.fd);
+		t_perf.bOpen = TRUE;
+	}
+	return t_perf.fd;
+}
+
+//=============================================================================
+
+void lda_perf_begin(LDAPERFMARK *pMark)
+{
+	int *fd;
+	INT i;
+
+	pMark->bOn = s_bOn.load(std::memory_order_relaxed);
+	if (!pMark->bOn)
+		return;
+
+	fd = perf_thread();
+	for (i = 0; i < LDA_PERF_EVENTS; i++){
+		if (!perf_read(fd[i], &pMark->value[i], &pMark->enabled[i], &pMark->running[i]))
+			pMark->value[i] = -1;
+	}
+}
+
+void lda_perf_end(LDAPERFMARK *pMark, INT phase)
+{
+	double delta[LDA_PERF_EVENTS];
+	double value, enabled, running;
+	int *fd;
+	INT i;
+
+	if (!pMark->bOn || phase < 0 || phase >= LDA_PERF_PHASES)
+		return;
+
+	// a counter the PMU multiplexed with others ran only part of the time
+	fd = perf_thread();
+	for (i = 0; i < LDA_PERF_EVENTS; i++){
+		delta[i] = 0;
+		if (pMark->value[i] < 0 || !perf_read(fd[i], &value, &enabled, &running))
+			continue;
+		delta[i] = value - pMark->value[i];
+		if (running > pMark->running[i])
+			delta[i] *= (enabled - pMark->enabled[i]) / (running - pMark->running[i]);
+	}
+
+	std::lock_guard<std::mutex> lk(s_lock);
+	s_phase[phase].calls += 1;
+	for (i = 0; i < EV_FP; i++)
+		s_phase[phase].value[i] += delta[i];
+	for (i = 0; i < 4; i++)
+		s_phase[phase].value[EV_FP] += delta[EV_FP + i] * s_fpWidth[i];
+}
+
+INT LDA_PerfEnable(BOOL bEnable)
+{
+	int fd[LDA_PERF_EVENTS];
+	INT i, n;
+
+	if (!bEnable){
+		s_bOn = false;
+		return 0;
+	}
+
+	// probe what the host exposes on a throwaway set
+	perf_open_all(fd);
+	{
+		std::lock_guard<std::mutex> lk(s_lock);
+		for (i = 0; i < EV_FP; i++)
+			s_bAvail[i] = fd[i] >= 0;
+		s_bAvail[EV_FP] = fd[EV_FP] >= 0 && fd[EV_FP + 1] >= 0 && fd[EV_FP + 2] >= 0 && fd[EV_FP + 3] >= 0;
+	}
+	for (i = 0; i < LDA_PERF_EVENTS; i++)
+		perf_close(fd[i]);
+
+	n = 0;
+	for (i = EV_CYCLES; i <= EV_FP; i++){
+		if (s_bAvail[i])
+			n++;
+	}
+	if (!s_bAvail[EV_CLOCK] && n == 0)
+		return -1;
+
+	s_bOn = true;
+	return n;
+}
+
+INT LDA_PerfReset(void)
+{
+	std::lock_guard<std::mutex> lk(s_lock);
+
+	memset(s_phase, 0, sizeof(s_phase));
+	return 0;
+}
+
+INT LDA_PerfGet(INT phase, LDA_PERF *perf)
+{
+	PERFPHASE *p;
+
+	if (phase < 0 || phase >= LDA_PERF_PHASES || perf == NULL)
+		return -1;
+
+	std::lock_guard<std::mutex> lk(s_lock);
+	p = s_phase + phase;
+	perf->calls = p->calls;
+	perf->seconds = s_bAvail[EV_CLOCK] ? p->value[EV_CLOCK] * 1e-9 : -1;
+	perf->cycles = s_bAvail[EV_CYCLES] ? p->value[EV_CYCLES] : -1;
+	perf->instructions = s_bAvail[EV_INSTR] ? p->value[EV_INSTR] : -1;
+	perf->llcMisses = s_bAvail[EV_LLC] ? p->value[EV_LLC] : -1;
+	perf->fpOps = s_bAvail[EV_FP] ? p->value[EV_FP] : -1;
+	return 0;
+}
+
+// a count, or null where the host has no such counter
+static void perf_json(FILE *fp, const char *name, double v, BOOL bLast)
+{
+	if (v < 0)
+		fprintf(fp, "\"%s\": null%s", name, bLast ? "" : ", ");
+	else
+		fprintf(fp, "\"%s\": %.0f%s", name, v, bLast ? "" : ", ");
+}
+
+static void perf_ratio(FILE *fp, const char *name, double a, double b, double scale, BOOL bLast)
+{
+	if (a < 0 || b <= 0)
+		fprintf(fp, "\"%s\": null%s", name, bLast ? "" : ", ");
+	else
+		fprintf(fp, "\"%s\": %.4g%s", name, a / b * scale, bLast ? "" : ", ");
+}
+
+// One JSON object, phases by name, each with its raw counts and the IPC,
+// LLC misses per thousand instructions and flops per cycle they give.
+INT LDA_PerfReport(const char *file)
+{
+	LDA_PERF perf;
+	FILE *fp;
+	INT i;
+
+	fp = (file == NULL || strcmp(file, "-") == 0) ? stdout : fopen(file, "w");
+	if (fp == NULL)
+		return -1;
+
+	fprintf(fp, "{\n");
+	for (i = 0; i < LDA_PERF_PHASES; i++){
+		LDA_PerfGet(i, &perf);
+		fprintf(fp, "  \"%s\": {\"calls\": %.0f, ", s_phaseName[i], perf.calls);
+		if (perf.seconds < 0)
+			fprintf(fp, "\"seconds\": null, ");
+		else
+			fprintf(fp, "\"seconds\": %.6g, ", perf.seconds);
+		perf_json(fp, "cycles", perf.cycles, FALSE);
+		perf_json(fp, "instructions", perf.instructions, FALSE);
+		perf_json(fp, "llc_misses", perf.llcMisses, FALSE);
+		perf_json(fp, "fp_ops", perf.fpOps, FALSE);
+		perf_ratio(fp, "ipc", perf.instructions, perf.cycles, 1, FALSE);
+		perf_ratio(fp, "llc_mpki", perf.llcMisses, perf.instructions, 1000, FALSE);
+		perf_ratio(fp, "flops_per_cycle", perf.fpOps, perf.cycles, 1, TRUE);
+		fprintf(fp, "}%s\n", i + 1 < LDA_PERF_PHASES ? "," : "");
+	}
+	fprintf(fp, "}");
+
+	if (fp != stdout)
+		fclose(fp);
+	else
+		fflush(fp);
+	return 0;
+}
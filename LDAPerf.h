@@ -0,0 +1,24 @@
+#ifndef __LDAPerf_h__
+#define __LDAPerf_h__
+
+#include "base_types.h"
+
+// counters read around a phase: task clock, cycles, instructions, LLC
+// misses and the four double-precision FP_ARITH_INST_RETIRED widths
+#define LDA_PERF_EVENTS	8
+
+// Counter values at lda_perf_begin. The pair costs two reads of every
+// counter when profiling is on (LDA_PerfEnable) and nothing when it is
+// off. Phases must not nest on a thread or both would count the inner
+// one; threads started inside a phase count toward it once joined.
+typedef struct LDAPERFMARK {
+	BOOL bOn;
+	double value[LDA_PERF_EVENTS];
+	double enabled[LDA_PERF_EVENTS];
+	double running[LDA_PERF_EVENTS];
+} LDAPERFMARK;
+
+void lda_perf_begin(LDAPERFMARK *pMark);
+void lda_perf_end(LDAPERFMARK *pMark, INT phase);
+
+#endif	//__LDAPerf_h__
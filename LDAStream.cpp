@@ -0,0 +1,811 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "base_types.h"
+#include "LDAApi.h"
+
+#ifdef LDA_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LDA_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Text input is read by a dedicated thread that decompresses into a bounded
+// ring of buffers, so decompression overlaps with parsing on the caller's
+// thread. Every buffer keeps STREAM_HEAD spare bytes in front of its data;
+// a token split across two buffers is moved into that space so the parser
+// always sees it contiguously.
+//
+// Build with LDA_HAVE_ZLIB for gzip and LDA_HAVE_ZSTD for zstd input; the
+// format is detected from the leading magic bytes.
+
+#define STREAM_SLOTS		4
+#define STREAM_SIZE			(1 << 20)
+#define STREAM_HEAD			256
+#define STREAM_ROWS			1024
+
+#define FORMAT_PLAIN		0
+#define FORMAT_GZIP			1
+#define FORMAT_ZSTD			2
+
+#ifndef MAX
+#define MAX(a,b)	((a) >= (b) ? (a) : (b))
+#endif
+
+#ifndef MIN
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#endif
+
+// bounded producer/consumer ring of slot indices
+typedef struct RING {
+	std::mutex lock;
+	std::condition_variable cv;
+	int head;			// next slot the producer fills
+	int tail;			// next slot the consumer takes
+	int count;			// slots filled and not yet released
+	int slots;
+	BOOL bDone;			// producer finished (count may still be > 0)
+	BOOL bStop;			// consumer gave up
+} RING;
+
+static void ring_init(RING *r, int slots)
+{
+	r->head = r->tail = r->count = 0;
+	r->slots = slots;
+	r->bDone = r->bStop = FALSE;
+}
+
+// producer: wait for a free slot, -1 if the consumer stopped
+static int ring_acquire(RING *r)
+{
+	std::unique_lock<std::mutex> lk(r->lock);
+	while (r->count == r->slots && !r->bStop)
+		r->cv.wait(lk);
+	if (r->bStop)
+		return -1;
+	return r->head;
+}
+
+static void ring_publish(RING *r, BOOL bDone)
+{
+	std::lock_guard<std::mutex> lk(r->lock);
+	if (!bDone){
+		r->head = (r->head + 1) % r->slots;
+		r->count++;
+	}
+	else
+		r->bDone = TRUE;
+	r->cv.notify_all();
+}
+
+// consumer: wait for a filled slot, -1 once the producer is done
+static int ring_take(RING *r, int ahead)
+{
+	std::unique_lock<std::mutex> lk(r->lock);
+	while (r->count <= ahead && !r->bDone)
+		r->cv.wait(lk);
+	if (r->count <= ahead)
+		return -1;
+	return (r->tail + ahead) % r->slots;
+}
+
+static void ring_release(RING *r)
+{
+	std::lock_guard<std::mutex> lk(r->lock);
+	r->tail = (r->tail + 1) % r->slots;
+	r->count--;
+	r->cv.notify_all();
+}
+
+static void ring_stop(RING *r)
+{
+	std::lock_guard<std::mutex> lk(r->lock);
+	r->bStop = TRUE;
+	r->cv.notify_all();
+}
+
+typedef struct STREAM {
+	FILE *fp;
+	int format;
+	char *in;			// raw (compressed) input
+	INT inPos;
+	INT inLen;
+#ifdef LDA_HAVE_ZLIB
+	z_stream zs;
+	BOOL bInflate;
+#endif
+#ifdef LDA_HAVE_ZSTD
+	ZSTD_DCtx *zd;
+#endif
+	BOOL bEnd;			// decoder between gzip members or zstd frames
+	BOOL bError;
+
+	RING ring;
+	char *data[STREAM_SLOTS];
+	INT len[STREAM_SLOTS];
+	std::thread reader;
+
+	// parser state
+	int cur;
+	char *pos;
+	char *end;
+	BOOL bLast;
+	char last[STREAM_HEAD + 1];
+} STREAM;
+
+static INT stream_input(STREAM *p)
+{
+	if (p->inPos < p->inLen)
+		return p->inLen - p->inPos;
+	p->inPos = 0;
+	p->inLen = (INT)fread(p->in, 1, STREAM_SIZE, p->fp);
+	if (p->inLen == 0 && ferror(p->fp))
+		return -1;
+	return p->inLen;
+}
+
+// Decodes up to size bytes into dst; -1 on a read or decode error, and
+// on compressed input that ends inside a gzip member or zstd frame.
+static INT stream_fill(STREAM *p, char *dst, INT size)
+{
+	INT n = 0, m, n0;
+
+	while (n < size){
+		m = stream_input(p);
+		if (m < 0)
+			return -1;
+		if (m == 0 && p->bEnd)
+			return n;
+
+		// at the end of the input a decoder may still hold output; once it
+		// has none left, an unfinished member or frame is a truncation
+		n0 = n;
+		switch (p->format){
+#ifdef LDA_HAVE_ZLIB
+		case FORMAT_GZIP:
+			{
+				int ret;
+				p->zs.next_in = (Bytef *)p->in + p->inPos;
+				p->zs.avail_in = m;
+				p->zs.next_out = (Bytef *)dst + n;
+				p->zs.avail_out = size - n;
+				ret = inflate(&p->zs, Z_NO_FLUSH);
+				if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+					return -1;
+				p->inPos += m - (INT)p->zs.avail_in;
+				n = size - (INT)p->zs.avail_out;
+				p->bEnd = (ret == Z_STREAM_END);
+				// concatenated members decode as one stream
+				if (ret == Z_STREAM_END && inflateReset(&p->zs) != Z_OK)
+					return -1;
+			}
+			break;
+#endif
+#ifdef LDA_HAVE_ZSTD
+		case FORMAT_ZSTD:
+			{
+				ZSTD_inBuffer zin = { p->in + p->inPos, (size_t)m, 0 };
+				ZSTD_outBuffer zout = { dst + n, (size_t)(size - n), 0 };
+				size_t ret = ZSTD_decompressStream(p->zd, &zout, &zin);
+				if (ZSTD_isError(ret))
+					return -1;
+				p->inPos += (INT)zin.pos;
+				n += (INT)zout.pos;
+				p->bEnd = (ret == 0);
+			}
+			break;
+#endif
+		default:
+			m = MIN(m, size - n);
+			memcpy(dst + n, p->in + p->inPos, m);
+			p->inPos += m;
+			n += m;
+			break;
+		}
+		if (m == 0 && n == n0 && !p->bEnd)
+			return -1;
+	}
+
+	return n;
+}
+
+static void stream_reader(STREAM *p)
+{
+	INT n;
+	int s;
+
+	for (;;){
+		s = ring_acquire(&p->ring);
+		if (s < 0)
+			break;
+		n = stream_fill(p, p->data[s] + STREAM_HEAD, STREAM_SIZE);
+		if (n <= 0){
+			if (n < 0)
+				p->bError = TRUE;
+			break;
+		}
+		p->len[s] = n;
+		p->data[s][STREAM_HEAD + n] = '\0';
+		ring_publish(&p->ring, FALSE);
+	}
+	ring_publish(&p->ring, TRUE);
+}
+
+HANDLE LDA_StreamOpen(const char *file)
+{
+	STREAM *p = NULL;
+	unsigned char *magic;
+	int i;
+
+	if (file == NULL)
+		return NULL;
+
+	p = new STREAM;
+	p->fp = (strcmp(file, "-") == 0) ? stdin : fopen(file, "rb");
+	p->format = FORMAT_PLAIN;
+	p->in = NULL;
+	p->inPos = p->inLen = 0;
+#ifdef LDA_HAVE_ZLIB
+	p->bInflate = FALSE;
+#endif
+#ifdef LDA_HAVE_ZSTD
+	p->zd = NULL;
+#endif
+	p->bEnd = TRUE;
+	p->bError = FALSE;
+	p->cur = -1;
+	p->pos = p->end = NULL;
+	p->bLast = FALSE;
+	ring_init(&p->ring, STREAM_SLOTS);
+	for (i = 0; i < STREAM_SLOTS; i++)
+		p->data[i] = NULL;
+	if (p->fp == NULL){
+		delete p;
+		return NULL;
+	}
+
+	p->in = (char *)malloc(STREAM_SIZE);
+	if (p->in == NULL)
+		goto L_ERROR;
+
+	// sniff the format from the first input block, which is then decoded
+	// as usual, so pipes work as well as regular files
+	if (stream_input(p) < 0)
+		goto L_ERROR;
+	magic = (unsigned char *)p->in;
+	if (p->inLen >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		p->format = FORMAT_GZIP;
+	else if (p->inLen >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+		p->format = FORMAT_ZSTD;
+
+	p->bEnd = (p->format == FORMAT_PLAIN);
+	switch (p->format){
+	case FORMAT_GZIP:
+#ifdef LDA_HAVE_ZLIB
+		memset(&p->zs, 0, sizeof(p->zs));
+		if (inflateInit2(&p->zs, 16 + MAX_WBITS) != Z_OK)
+			goto L_ERROR;
+		p->bInflate = TRUE;
+		break;
+#else
+		fprintf(stderr, "ERROR: gzip input requires LDA_HAVE_ZLIB.\n");
+		goto L_ERROR;
+#endif
+	case FORMAT_ZSTD:
+#ifdef LDA_HAVE_ZSTD
+		p->zd = ZSTD_createDCtx();
+		if (p->zd == NULL)
+			goto L_ERROR;
+		break;
+#else
+		fprintf(stderr, "ERROR: zstd input requires LDA_HAVE_ZSTD.\n");
+		goto L_ERROR;
+#endif
+	default:
+		break;
+	}
+
+	for (i = 0; i < STREAM_SLOTS; i++){
+		p->data[i] = (char *)malloc(STREAM_HEAD + STREAM_SIZE + 1);
+		if (p->data[i] == NULL)
+			goto L_ERROR;
+	}
+
+	p->reader = std::thread(stream_reader, p);
+
+	return p;
+
+L_ERROR:
+
+	LDA_StreamClose(p);
+
+	return NULL;
+}
+
+INT LDA_StreamClose(HANDLE hStream)
+{
+	STREAM *p = (STREAM *)hStream;
+	int i;
+
+	if (p == NULL)
+		return -1;
+
+	ring_stop(&p->ring);
+	if (p->reader.joinable())
+		p->reader.join();
+
+#ifdef LDA_HAVE_ZLIB
+	if (p->bInflate)
+		inflateEnd(&p->zs);
+#endif
+#ifdef LDA_HAVE_ZSTD
+	if (p->zd)
+		ZSTD_freeDCtx(p->zd);
+#endif
+	if (p->fp && p->fp != stdin)
+		fclose(p->fp);
+	if (p->in)
+		free(p->in);
+	for (i = 0; i < STREAM_SLOTS; i++){
+		if (p->data[i])
+			free(p->data[i]);
+	}
+	delete p;
+	return 0;
+}
+
+// Moves the parser to the next buffer, carrying the unfinished token at
+// [pos, end) along. Returns 0 once the input is exhausted.
+static int stream_next(STREAM *p)
+{
+	INT carry = (INT)(p->end - p->pos);
+	int s;
+
+	if (p->bLast)
+		return 0;
+	if (carry > STREAM_HEAD){
+		p->bError = TRUE;
+		return -1;
+	}
+
+	s = ring_take(&p->ring, (p->cur < 0) ? 0 : 1);
+	if (s < 0){
+		// end of input: the carried token is the last one
+		memcpy(p->last, p->pos, carry);
+		p->last[carry] = '\0';
+		p->pos = p->last;
+		p->end = p->last + carry;
+		p->bLast = TRUE;
+		if (p->cur >= 0){
+			ring_release(&p->ring);
+			p->cur = -1;
+		}
+		return (p->bError) ? -1 : (carry > 0);
+	}
+
+	memcpy(p->data[s] + STREAM_HEAD - carry, p->pos, carry);
+	if (p->cur >= 0)
+		ring_release(&p->ring);
+	p->cur = s;
+	p->pos = p->data[s] + STREAM_HEAD - carry;
+	p->end = p->data[s] + STREAM_HEAD + p->len[s];
+	return 1;
+}
+
+static const double kPow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Decimal fast path: with at most 15 significant digits and |exponent|
+// <= 22 both operands are exact doubles, so one multiply or divide gives
+// the correctly rounded result. Anything else is left to strtod.
+static int parse_double(const char *s, const char *e, double *v)
+{
+	const char *p = s;
+	unsigned long long m = 0;
+	int digits = 0, scale = 0, ex = 0, exneg = 0, neg = 0;
+	char *stop;
+
+	if (p < e && (*p == '-' || *p == '+'))
+		neg = (*p++ == '-');
+	while (p < e && *p >= '0' && *p <= '9'){
+		if (digits < 19)
+			m = m * 10 + (*p - '0');
+		else
+			scale++;
+		if (m)
+			digits++;
+		p++;
+	}
+	if (p < e && *p == '.'){
+		p++;
+		while (p < e && *p >= '0' && *p <= '9'){
+			if (digits < 19){
+				m = m * 10 + (*p - '0');
+				scale--;
+			}
+			if (m)
+				digits++;
+			p++;
+		}
+	}
+	if (p == s || (p == s + 1 && (*s == '-' || *s == '+' || *s == '.')))
+		goto L_SLOW;
+	if (p < e && (*p == 'e' || *p == 'E')){
+		p++;
+		if (p < e && (*p == '-' || *p == '+'))
+			exneg = (*p++ == '-');
+		if (p == e)
+			goto L_SLOW;
+		while (p < e && *p >= '0' && *p <= '9' && ex < 10000)
+			ex = ex * 10 + (*p++ - '0');
+		scale += exneg ? -ex : ex;
+	}
+	if (p != e || digits > 15 || scale < -22 || scale > 22)
+		goto L_SLOW;
+
+	*v = (scale < 0) ? (double)m / kPow10[-scale] : (double)m * kPow10[scale];
+	if (neg)
+		*v = -*v;
+	return 0;
+
+L_SLOW:
+
+	*v = strtod(s, &stop);
+	return (stop == e) ? 0 : -1;
+}
+
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',';
+}
+
+INT LDA_StreamRead(HANDLE hStream, double *v, INT len)
+{
+	STREAM *p = (STREAM *)hStream;
+	char *t;
+	int ret;
+	INT i = 0;
+
+	if (p == NULL || v == NULL)
+		return -1;
+
+	while (i < len){
+		while (p->pos < p->end && is_space(*p->pos))
+			p->pos++;
+		if (p->pos == p->end){
+			ret = stream_next(p);
+			if (ret < 0)
+				return -1;
+			if (ret == 0)
+				break;
+			continue;
+		}
+
+		t = p->pos;
+		while (t < p->end && !is_space(*t))
+			t++;
+		if (t == p->end && !p->bLast){
+			// token may continue in the next buffer
+			if (stream_next(p) < 0)
+				return -1;
+			continue;
+		}
+
+		if (parse_double(p->pos, t, &v[i]) != 0){
+			p->bError = TRUE;
+			return -1;
+		}
+		p->pos = t;
+		i++;
+	}
+
+	return i;
+}
+
+//=============================================================================
+
+// LDA_StreamAdd and LDA_StreamProject run the parser on its own thread as
+// well and hand parsed row blocks to the caller's thread through a second
+// ring, giving a read/decompress -> parse -> compute pipeline.
+
+typedef struct ROWBLOCK {
+	double *v;
+	INT *k;
+	INT n;
+} ROWBLOCK;
+
+typedef struct PARSER {
+	STREAM *pStream;
+	INT d;
+	BOOL bLabel;		// rows carry a trailing label column
+	INT labelBase;
+	double *row;
+	RING ring;
+	ROWBLOCK block[STREAM_SLOTS];
+	std::thread thread;
+	BOOL bError;
+} PARSER;
+
+static void stream_parser(PARSER *pp)
+{
+	INT d = pp->d;
+	INT cols = d + (pp->bLabel ? 1 : 0);
+	ROWBLOCK *b;
+	INT r, ret = 0;
+	int s;
+
+	while (ret >= 0){
+		s = ring_acquire(&pp->ring);
+		if (s < 0)
+			break;
+		b = &pp->block[s];
+		for (r = 0; r < STREAM_ROWS; r++){
+			ret = LDA_StreamRead(pp->pStream, pp->row, cols);
+			if (ret != cols){
+				if (ret != 0)
+					pp->bError = TRUE;
+				ret = -1;
+				break;
+			}
+			memcpy(b->v + r * d, pp->row, sizeof(double) * d);
+			if (pp->bLabel)
+				b->k[r] = (INT)floor(pp->row[d] + 0.5) - pp->labelBase;
+		}
+		b->n = r;
+		if (r > 0)
+			ring_publish(&pp->ring, FALSE);
+	}
+	ring_publish(&pp->ring, TRUE);
+}
+
+static PARSER *parser_create(HANDLE hStream, INT d, BOOL bLabel, INT labelBase)
+{
+	PARSER *pp;
+	int i;
+
+	pp = new PARSER;
+	pp->pStream = (STREAM *)hStream;
+	pp->d = d;
+	pp->bLabel = bLabel;
+	pp->labelBase = labelBase;
+	pp->bError = FALSE;
+	pp->row = new double [d + 1];
+	ring_init(&pp->ring, STREAM_SLOTS);
+	for (i = 0; i < STREAM_SLOTS; i++){
+		pp->block[i].v = new double [STREAM_ROWS * d];
+		pp->block[i].k = new INT [STREAM_ROWS];
+	}
+
+	pp->thread = std::thread(stream_parser, pp);
+
+	return pp;
+}
+
+// returns -1 if parsing failed
+static INT parser_release(PARSER *pp)
+{
+	INT ret;
+	int i;
+
+	ring_stop(&pp->ring);
+	pp->thread.join();
+	ret = pp->bError ? -1 : 0;
+
+	for (i = 0; i < STREAM_SLOTS; i++){
+		delete [] pp->block[i].v;
+		delete [] pp->block[i].k;
+	}
+	delete [] pp->row;
+	delete pp;
+
+	return ret;
+}
+
+INT LDA_StreamAdd(HANDLE hLDA, HANDLE hStream, INT labelBase)
+{
+	PARSER *pp = NULL;
+	INT d, q, ret = 0;
+	int s;
+
+	if (hStream == NULL || LDA_GetInfo(hLDA, &d, &q) != 0)
+		return -1;
+
+	pp = parser_create(hStream, d, TRUE, labelBase);
+
+	while ((s = ring_take(&pp->ring, 0)) >= 0){
+		ret = LDA_AddBatch(hLDA, pp->block[s].v, pp->block[s].k, pp->block[s].n);
+		ring_release(&pp->ring);
+		if (ret < 0)
+			break;
+	}
+
+	if (parser_release(pp) != 0)
+		ret = -1;
+
+	return ret;
+}
+
+//=============================================================================
+
+// Output side of LDA_StreamProject: the caller formats into a ring of large
+// buffers and a writer thread drains them with one fwrite per buffer.
+
+typedef struct WRITER {
+	FILE *fp;
+	RING ring;
+	char *data[STREAM_SLOTS];
+	INT len[STREAM_SLOTS];
+	std::thread thread;
+	BOOL bError;
+} WRITER;
+
+static void stream_writer(WRITER *pw)
+{
+	int s;
+
+	while ((s = ring_take(&pw->ring, 0)) >= 0){
+		if (!pw->bError && fwrite(pw->data[s], 1, pw->len[s], pw->fp) != (size_t)pw->len[s])
+			pw->bError = TRUE;
+		ring_release(&pw->ring);
+	}
+	if (fflush(pw->fp) != 0)
+		pw->bError = TRUE;
+}
+
+static const unsigned long long kPow10i[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+// Fixed-point formatting of x with prec (<= 9) decimals, at most 31 bytes.
+// Values whose scaled magnitude does not fit 60 bits, and non-finite
+// values, fall back to %.17g.
+static char *format_double(char *p, double x, int prec)
+{
+	unsigned long long u, ip, fp;
+	char digits[24];
+	double a = fabs(x) * (double)kPow10i[prec] + 0.5;
+	int n, i;
+
+	if (!(a < 1e18))
+		return p + snprintf(p, 32, "%.17g", x);
+
+	u = (unsigned long long)a;
+	ip = u / kPow10i[prec];
+	fp = u % kPow10i[prec];
+
+	if (x < 0 && u != 0)
+		*p++ = '-';
+	n = 0;
+	do {
+		digits[n++] = (char)('0' + ip % 10);
+		ip /= 10;
+	} while (ip);
+	while (n > 0)
+		*p++ = digits[--n];
+	if (prec > 0){
+		*p++ = '.';
+		for (i = prec - 1; i >= 0; i--){
+			p[i] = (char)('0' + fp % 10);
+			fp /= 10;
+		}
+		p += prec;
+	}
+	return p;
+}
+
+INT LDA_StreamProject(HANDLE hStream, HANDLE hModel, INT k, BOOL bLabel,
+	const char *outFile, INT type, INT precision)
+{
+	PARSER *pp = NULL;
+	WRITER *pw = NULL;
+	double *u = NULL;
+	float *uf;
+	INT n, r, i, ret = 0;
+	INT d, kmax, rowBytes, total = 0;
+	char *out = NULL;
+	int s, w = -1;
+
+	if (hStream == NULL || LDA_ModelInfo(hModel, &d, &kmax, NULL) != 0)
+		return -1;
+	if (k <= 0 || k > kmax)
+		return -1;
+	if (type != 0 && type != LDA_FLOAT32 && type != LDA_FLOAT64)
+		return -1;
+	precision = MIN(MAX(precision, 0), 9);
+	rowBytes = (type != 0) ? k * type : k * 32;
+	if (rowBytes > STREAM_SIZE)
+		return -1;
+
+	pw = new WRITER;
+	pw->fp = (outFile == NULL || strcmp(outFile, "-") == 0) ? stdout : fopen(outFile, (type != 0) ? "wb" : "w");
+	pw->bError = FALSE;
+	ring_init(&pw->ring, STREAM_SLOTS);
+	for (i = 0; i < STREAM_SLOTS; i++)
+		pw->data[i] = NULL;
+	if (pw->fp == NULL){
+		delete pw;
+		return -1;
+	}
+	for (i = 0; i < STREAM_SLOTS; i++){
+		pw->data[i] = (char *)malloc(STREAM_SIZE);
+		if (pw->data[i] == NULL)
+			ret = -1;
+	}
+	u = (double *)malloc(sizeof(double) * STREAM_ROWS * k);
+	if (u == NULL)
+		ret = -1;
+	if (ret == 0){
+		pw->thread = std::thread(stream_writer, pw);
+		pp = parser_create(hStream, d, bLabel, 0);
+	}
+
+	while (pp && (s = ring_take(&pp->ring, 0)) >= 0){
+		n = pp->block[s].n;
+		LDA_ModelProject(hModel, k, pp->block[s].v, n, u);
+		ring_release(&pp->ring);
+
+		for (r = 0; r < n; r++){
+			if (w >= 0 && pw->len[w] + rowBytes > STREAM_SIZE){
+				ring_publish(&pw->ring, FALSE);
+				w = -1;
+			}
+			if (w < 0){
+				w = ring_acquire(&pw->ring);
+				if (w < 0)
+					break;
+				pw->len[w] = 0;
+			}
+			out = pw->data[w] + pw->len[w];
+			if (type == LDA_FLOAT64){
+				memcpy(out, u + r * k, sizeof(double) * k);
+				out += sizeof(double) * k;
+			}
+			else if (type == LDA_FLOAT32){
+				uf = (float *)out;
+				for (i = 0; i < k; i++)
+					uf[i] = (float)u[r * k + i];
+				out += sizeof(float) * k;
+			}
+			else {
+				for (i = 0; i < k; i++){
+					out = format_double(out, u[r * k + i], precision);
+					*out++ = (i == k - 1) ? '\n' : ' ';
+				}
+			}
+			pw->len[w] = (INT)(out - pw->data[w]);
+		}
+		if (w < 0)
+			break;
+		total += n;
+	}
+
+	if (w >= 0)
+		ring_publish(&pw->ring, FALSE);
+	if (pp && parser_release(pp) != 0)
+		ret = -1;
+	ring_publish(&pw->ring, TRUE);
+	if (pw->thread.joinable())
+		pw->thread.join();
+	if (pw->bError)
+		ret = -1;
+
+	if (pw->fp != stdout)
+		fclose(pw->fp);
+	for (i = 0; i < STREAM_SLOTS; i++){
+		if (pw->data[i])
+			free(pw->data[i]);
+	}
+	delete pw;
+	if (u)
+		free(u);
+
+	return (ret < 0) ? -1 : total;
+}
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <atomic>
+#include "base_types.h"
+#include "LDAApi.h"
+#include "FileMap.h"
+#include "LDAKernel.h"
+
+#ifndef MIN
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a,b)	((a) >= (b) ? (a) : (b))
+#endif
+
+#define TILE_SIZE	256				// tile side, 512 KB of doubles
+#define TILE_BUFFER	(64 << 20)		// default bytes of buffered rows
+
+// Out-of-core LDA for d whose d*d scatter does not fit in memory. The
+// within-class scatter lives in a memory-mapped file as the lower triangle
+// of TILE_SIZE*TILE_SIZE tiles, tile (I,J) (J <= I) at tile index
+// I*(I+1)/2 + J, each tile row-major with stride TILE_SIZE. Only the
+// class sums (q*d) and a buffer of rows stay in memory.
+//
+// Rows are shifted by the first sample of their class, as in LDA_Add, and
+// all classes go into the one file matrix
+//
+//     S = sum_c sum_x (x - K_c)(x - K_c)',  Sw = S - sum_c N_c*d_c*d_c'
+//
+// with d_c = m_c - K_c, so the file holds q times less than per-class
+// scatters would. Buffered rows are folded in one pass over the file,
+// tile by tile in file order, so each tile is streamed once per buffer.
+//
+// LDA_TiledSolve factors Sw + lambda*I in place, tile row by tile row
+// (left-looking Cholesky: row I reads tile rows I and J < I, both
+// contiguous in the file), solves C = L^-1 * B for Sb = B*B', takes the
+// q*q eigenproblem C'*C and maps its vectors back with L^-T. The handle is
+// spent afterwards.
+
+typedef struct TILED {
+	INT d;
+	INT q;
+	INT nt;				// tiles per side
+	char *path;
+	FILEMAP map;
+	double *S;			// map.base
+	double *shift;		// q*d, K_c
+	BOOL *bShift;
+	double *C;			// q*d, sums of x - K_c
+	double *N;			// q
+	double *X;			// rows*d, buffered shifted rows
+	INT rows;
+	INT nRows;
+	INT count;			// samples
+	BOOL bSolved;
+} TILED;
+
+typedef struct TILEJOB {
+	TILED *pTiled;
+	const double *X;
+	INT n;
+	std::atomic<INT> next;
+} TILEJOB;
+
+int SymmetricEigenDecomposition(int n, double *a, double *w);
+
+static double *tile(TILED *pTiled, INT I, INT J)
+{
+	return pTiled->S + ((INT64)I * (I + 1) / 2 + J) * TILE_SIZE * TILE_SIZE;
+}
+
+static INT tile_width(TILED *pTiled, INT I)
+{
+	return MIN(TILE_SIZE, pTiled->d - I * TILE_SIZE);
+}
+
+// Tile row I += X' * X restricted to it, n rows of X (stride d). Diagonal
+// tiles get their lower triangle only.
+static void tile_row_update(TILED *pTiled, INT I, const double *X, INT n)
+{
+	INT d = pTiled->d;
+	INT wI = tile_width(pTiled, I);
+	const LDAKERNEL *K = lda_kernel();
+	INT J, wJ, r, a;
+	const double *xi, *xj;
+	double *A;
+	double t[4];
+
+	// four rows per sweep over the tile
+	for (J = 0; J <= I; J++){
+		A = tile(pTiled, I, J);
+		wJ = tile_width(pTiled, J);
+		for (r = 0; r + 4 <= n; r += 4){
+			xi = X + (INT64)r * d + I * TILE_SIZE;
+			xj = X + (INT64)r * d + J * TILE_SIZE;
+			for (a = 0; a < wI; a++){
+				t[0] = xi[a];
+				t[1] = xi[d + a];
+				t[2] = xi[2 * d + a];
+				t[3] = xi[3 * d + a];
+				K->axpy4((J == I) ? a + 1 : wJ, t, xj, xj + d, xj + 2 * d, xj + 3 * d, A + a * TILE_SIZE);
+			}
+		}
+		for (; r < n; r++){
+			xi = X + (INT64)r * d + I * TILE_SIZE;
+			xj = X + (INT64)r * d + J * TILE_SIZE;
+			for (a = 0; a < wI; a++)
+				K->axpy((J == I) ? a + 1 : wJ, xi[a], xj, A + a * TILE_SIZE);
+		}
+	}
+}
+
+static void tile_worker(TILEJOB *pJob)
+{
+	INT I;
+
+	while ((I = pJob->next.fetch_add(1)) < pJob->pTiled->nt)
+		tile_row_update(pJob->pTiled, I, pJob->X, pJob->n);
+}
+
+// Folds the buffered rows into the file; tile rows are spread over
+// threads, each streaming its own contiguous stretch of the file.
+static void tiled_flush(TILED *pTiled)
+{
+	TILEJOB job;
+	std::thread *worker;
+	INT i, nThread;
+
+	if (pTiled->nRows == 0)
+		return;
+
+	job.pTiled = pTiled;
+	job.X = pTiled->X;
+	job.n = pTiled->nRows;
+	job.next = 0;
+	nThread = MAX(1, MIN(pTiled->nt, (INT)std::thread::hardware_concurrency()));
+	worker = new std::thread [nThread];
+	for (i = 0; i < nThread; i++)
+		worker[i] = std::thread(tile_worker, &job);
+	for (i = 0; i < nThread; i++)
+		worker[i].join();
+	delete [] worker;
+
+	pTiled->nRows = 0;
+}
+
+// rows: rows buffered between passes over the file, 0 for about
+// TILE_BUFFER bytes. The file is created (or truncated) and removed again
+// by LDA_TiledRelease; it needs d*d*4 bytes plus up to one tile row.
+HANDLE LDA_TiledCreate(INT d, INT q, const char *file, INT rows)
+{
+	TILED *pTiled;
+	FILE *fp;
+	INT64 size;
+
+	if (d <= 0 || q <= 0 || file == NULL || rows < 0)
+		return NULL;
+
+	// start from an empty file so that the mapping reads as zeros
+	fp = fopen(file, "wb");
+	if (fp == NULL)
+		return NULL;
+	fclose(fp);
+
+	pTiled = (TILED *)calloc(1, sizeof(TILED));
+	if (pTiled == NULL){
+		remove(file);
+		return NULL;
+	}
+	pTiled->d = d;
+	pTiled->q = q;
+	pTiled->nt = (d + TILE_SIZE - 1) / TILE_SIZE;
+	if (rows == 0)
+		rows = (INT)MAX(1, MIN(65536, (INT64)TILE_BUFFER / ((INT64)sizeof(double) * d)));
+	pTiled->rows = MAX(rows, q);
+
+	pTiled->path = (char *)malloc(strlen(file) + 1);
+	if (pTiled->path == NULL){
+		free(pTiled);
+		remove(file);
+		return NULL;
+	}
+	strcpy(pTiled->path, file);
+
+	size = (INT64)pTiled->nt * (pTiled->nt + 1) / 2 * TILE_SIZE * TILE_SIZE * sizeof(double);
+	if (FileMap_Open(&pTiled->map, file, TRUE, size) != 0){
+		LDA_TiledRelease(pTiled);
+		return NULL;
+	}
+	pTiled->S = (double *)pTiled->map.base;
+
+	pTiled->shift = (double *)malloc(sizeof(double) * (INT64)q * d);
+	pTiled->bShift = (BOOL *)calloc(q, sizeof(BOOL));
+	pTiled->C = (double *)calloc((INT64)q * d, sizeof(double));
+	pTiled->N = (double *)calloc(q, sizeof(double));
+	pTiled->X = (double *)malloc(sizeof(double) * (INT64)pTiled->rows * d);
+	if (pTiled->shift == NULL || pTiled->bShift == NULL || pTiled->C == NULL || pTiled->N == NULL ||
+		pTiled->X == NULL){
+		LDA_TiledRelease(pTiled);
+		return NULL;
+	}
+
+	return pTiled;
+}
+
+INT LDA_TiledRelease(HANDLE hTiled)
+{
+	TILED *pTiled = (TILED *)hTiled;
+
+	if (pTiled == NULL)
+		return -1;
+	if (pTiled->map.base)
+		FileMap_Close(&pTiled->map);
+	if (pTiled->path){
+		remove(pTiled->path);
+		free(pTiled->path);
+	}
+	if (pTiled->shift)
+		free(pTiled->shift);
+	if (pTiled->bShift)
+		free(pTiled->bShift);
+	if (pTiled->C)
+		free(pTiled->C);
+	if (pTiled->N)
+		free(pTiled->N);
+	if (pTiled->X)
+		free(pTiled->X);
+	free(pTiled);
+
+	return 0;
+}
+
+// n rows of d values, labels in [0, q); returns the samples so far
+INT LDA_TiledAdd(HANDLE hTiled, const double *v, const INT *k, INT n)
+{
+	TILED *pTiled = (TILED *)hTiled;
+	const double *x;
+	double *K, *c, *y;
+	INT d, r, j;
+
+	if (pTiled == NULL || v == NULL || k == NULL || n < 0 || pTiled->bSolved)
+		return -1;
+	d = pTiled->d;
+	for (r = 0; r < n; r++){
+		if (k[r] < 0 || k[r] >= pTiled->q)
+			return -1;
+	}
+
+	for (r = 0; r < n; r++){
+		x = v + (INT64)r * d;
+		K = pTiled->shift + (INT64)k[r] * d;
+		if (!pTiled->bShift[k[r]]){
+			memcpy(K, x, sizeof(double) * d);
+			pTiled->bShift[k[r]] = TRUE;
+		}
+		c = pTiled->C + (INT64)k[r] * d;
+		y = pTiled->X + (INT64)pTiled->nRows * d;
+		for (j = 0; j < d; j++){
+			y[j] = x[j] - K[j];
+			c[j] += y[j];
+		}
+		pTiled->N[k[r]] += 1;
+		pTiled->count++;
+		if (++pTiled->nRows == pTiled->rows)
+			tiled_flush(pTiled);
+	}
+
+	return pTiled->count;
+}
+
+// A (wI*wJ, stride TILE_SIZE) -= P * Q', P wI*wK and Q wJ*wK. Q is
+// transposed into T first so the update runs along rows of A. Only the
+// lower triangle when bLower.
+static void tile_gemm(double *A, const double *P, const double *Q, INT wI, INT wJ, INT wK, BOOL bLower, double *T)
+{
+	const LDAKERNEL *K = lda_kernel();
+	const double *p, *tc;
+	double *row;
+	double m[4];
+	INT a, b, c, e;
+
+	for (b = 0; b < wJ; b++){
+		for (c = 0; c < wK; c++)
+			T[c*TILE_SIZE + b] = Q[b*TILE_SIZE + c];
+	}
+	for (a = 0; a < wI; a++){
+		row = A + a * TILE_SIZE;
+		p = P + a * TILE_SIZE;
+		e = bLower ? a + 1 : wJ;
+		for (c = 0; c + 4 <= wK; c += 4){
+			tc = T + c * TILE_SIZE;
+			m[0] = -p[c];
+			m[1] = -p[c+1];
+			m[2] = -p[c+2];
+			m[3] = -p[c+3];
+			K->axpy4(e, m, tc, tc + TILE_SIZE, tc + 2 * TILE_SIZE, tc + 3 * TILE_SIZE, row);
+		}
+		for (; c < wK; c++)
+			K->axpy(e, -p[c], T + c * TILE_SIZE, row);
+	}
+}
+
+// Sw + lambda*I = L*L' in place. D (q*d) holds sqrt(N_c)*d_c, subtracted
+// from each tile just before it is first used.
+static INT tiled_cholesky(TILED *pTiled, const double *D, double lambda, double *T)
+{
+	INT nt = pTiled->nt;
+	INT d = pTiled->d;
+	INT q = pTiled->q;
+	INT I, J, K, wI, wJ, a, b, c;
+	double *A, *L, *row;
+	const double *di, *dj;
+	double s;
+
+	for (I = 0; I < nt; I++){
+		wI = tile_width(pTiled, I);
+		for (J = 0; J <= I; J++){
+			wJ = tile_width(pTiled, J);
+			A = tile(pTiled, I, J);
+
+			// the class mean correction and the ridge
+			for (c = 0; c < q; c++){
+				di = D + (INT64)c * d + I * TILE_SIZE;
+				dj = D + (INT64)c * d + J * TILE_SIZE;
+				for (a = 0; a < wI; a++){
+					row = A + a * TILE_SIZE;
+					for (b = 0; b < ((J == I) ? a + 1 : wJ); b++)
+						row[b] -= di[a] * dj[b];
+				}
+			}
+			if (J == I){
+				for (a = 0; a < wI; a++)
+					A[a*TILE_SIZE + a] += lambda;
+			}
+
+			for (K = 0; K < J; K++)
+				tile_gemm(A, tile(pTiled, I, K), tile(pTiled, J, K), wI, wJ, tile_width(pTiled, K), J == I, T);
+
+			L = tile(pTiled, J, J);
+			if (J < I){
+				// A = A * L_JJ^-T, row by row
+				for (a = 0; a < wI; a++){
+					row = A + a * TILE_SIZE;
+					for (b = 0; b < wJ; b++){
+						s = row[b];
+						for (c = 0; c < b; c++)
+							s -= row[c] * L[b*TILE_SIZE + c];
+						row[b] = s / L[b*TILE_SIZE + b];
+					}
+				}
+			}
+			else {
+				for (a = 0; a < wI; a++){
+					row = A + a * TILE_SIZE;
+					for (b = 0; b <= a; b++){
+						s = row[b];
+						for (c = 0; c < b; c++)
+							s -= row[c] * A[b*TILE_SIZE + c];
+						if (a == b){
+							if (!(s > 0))
+								return -1;
+							row[a] = sqrt(s);
+						}
+						else
+							row[b] = s / A[b*TILE_SIZE + b];
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+// B = L^-1 * B, B d*m
+static void tiled_forward(TILED *pTiled, double *B, INT m)
+{
+	INT I, J, wI, wJ, a, b, j;
+	const double *L;
+	double *bi, *bj;
+	double t;
+
+	for (I = 0; I < pTiled->nt; I++){
+		wI = tile_width(pTiled, I);
+		for (J = 0; J <= I; J++){
+			wJ = tile_width(pTiled, J);
+			L = tile(pTiled, I, J);
+			for (a = 0; a < wI; a++){
+				bi = B + (INT64)(I * TILE_SIZE + a) * m;
+				for (b = 0; b < ((J == I) ? a : wJ); b++){
+					t = L[a*TILE_SIZE + b];
+					bj = B + (INT64)(J * TILE_SIZE + b) * m;
+					for (j = 0; j < m; j++)
+						bi[j] -= t * bj[j];
+				}
+				if (J == I){
+					t = 1 / L[a*TILE_SIZE + a];
+					for (j = 0; j < m; j++)
+						bi[j] *= t;
+				}
+			}
+		}
+	}
+}
+
+// B = L^-T * B, B d*m, tile rows from the last one back
+static void tiled_backward(TILED *pTiled, double *B, INT m)
+{
+	INT I, J, wI, wJ, a, b, j;
+	const double *L;
+	double *bi, *bj;
+	double t;
+
+	for (J = pTiled->nt - 1; J >= 0; J--){
+		wJ = tile_width(pTiled, J);
+		L = tile(pTiled, J, J);
+		for (a = wJ - 1; a >= 0; a--){
+			bi = B + (INT64)(J * TILE_SIZE + a) * m;
+			t = 1 / L[a*TILE_SIZE + a];
+			for (j = 0; j < m; j++)
+				bi[j] *= t;
+			for (b = 0; b < a; b++){
+				t = L[a*TILE_SIZE + b];
+				bj = B + (INT64)(J * TILE_SIZE + b) * m;
+				for (j = 0; j < m; j++)
+					bj[j] -= t * bi[j];
+			}
+		}
+		for (I = 0; I < J; I++){
+			wI = tile_width(pTiled, I);
+			L = tile(pTiled, J, I);
+			for (a = 0; a < wJ; a++){
+				bj = B + (INT64)(J * TILE_SIZE + a) * m;
+				for (b = 0; b < wI; b++){
+					t = L[a*TILE_SIZE + b];
+					bi = B + (INT64)(I * TILE_SIZE + b) * m;
+					for (j = 0; j < m; j++)
+						bi[j] -= t * bj[j];
+				}
+			}
+		}
+	}
+}
+
+// Sb*v = l*(Sw + lambda*I)*v from the file, lambda >= 0 in the units of
+// Sw. eigenvector receives d*k (column j at row*k+j, normalized as in
+// LDA_Solve), eigenvalue k values in descending order; k is at most
+// min(d, q) and columns past the rank of Sb are zero. Sw is factored in
+// place, so the handle takes no more rows or solves afterwards.
+INT LDA_TiledSolve(HANDLE hTiled, double lambda, INT k, double *eigenvector, double *eigenvalue)
+{
+	TILED *pTiled = (TILED *)hTiled;
+	double *D = NULL;
+	double *B = NULL;
+	double *H = NULL;
+	double *mu = NULL;
+	double *T = NULL;
+	double *m, *V;
+	double total, t;
+	INT d, q, i, j, c;
+	INT ret = -1;
+
+	if (pTiled == NULL || eigenvector == NULL || pTiled->bSolved)
+		return -1;
+	d = pTiled->d;
+	q = pTiled->q;
+	if (k <= 0 || k > MIN(d, q) || !(lambda >= 0 && lambda < HUGE_VAL))
+		return -1;
+
+	tiled_flush(pTiled);
+	total = 0;
+	for (c = 0; c < q; c++)
+		total += pTiled->N[c];
+	if (total == 0)
+		return -1;
+
+	D = (double *)calloc((INT64)q * d, sizeof(double));
+	B = (double *)malloc(sizeof(double) * (INT64)d * q);
+	H = (double *)malloc(sizeof(double) * q * q);
+	mu = (double *)malloc(sizeof(double) * MAX(q, d));
+	T = (double *)malloc(sizeof(double) * TILE_SIZE * TILE_SIZE);
+	if (D == NULL || B == NULL || H == NULL || mu == NULL || T == NULL)
+		goto L_EXIT;
+
+	// D[c] = sqrt(N_c) * d_c, B[:,c] = sqrt(N_c) * (m_c - mean)
+	m = mu;
+	memset(m, 0, sizeof(double) * d);
+	for (c = 0; c < q; c++){
+		if (pTiled->N[c] == 0)
+			continue;
+		t = 1 / sqrt(pTiled->N[c]);
+		for (i = 0; i < d; i++){
+			D[(INT64)c * d + i] = t * pTiled->C[(INT64)c * d + i];
+			m[i] += pTiled->N[c] * pTiled->shift[(INT64)c * d + i] + pTiled->C[(INT64)c * d + i];
+		}
+	}
+	for (i = 0; i < d; i++)
+		m[i] /= total;
+	for (i = 0; i < d; i++){
+		for (c = 0; c < q; c++){
+			if (pTiled->N[c] == 0)
+				B[(INT64)i * q + c] = 0;
+			else
+				B[(INT64)i * q + c] = sqrt(pTiled->N[c]) *
+					(pTiled->shift[(INT64)c * d + i] + pTiled->C[(INT64)c * d + i] / pTiled->N[c] - m[i]);
+		}
+	}
+
+	pTiled->bSolved = TRUE;
+	if (tiled_cholesky(pTiled, D, lambda, T) != 0)
+		goto L_EXIT;
+
+	// C = L^-1 * B in place, then the q*q problem C'*C*u = l*u
+	tiled_forward(pTiled, B, q);
+	memset(H, 0, sizeof(double) * q * q);
+	for (i = 0; i < d; i++){
+		for (j = 0; j < q; j++){
+			t = B[(INT64)i * q + j];
+			for (c = 0; c <= j; c++)
+				H[j*q + c] += t * B[(INT64)i * q + c];
+		}
+	}
+	if (SymmetricEigenDecomposition(q, H, mu) != 0)
+		goto L_EXIT;
+
+	// v = L^-T * C * u for the k largest l
+	V = eigenvector;
+	for (i = 0; i < d; i++){
+		for (j = 0; j < k; j++){
+			t = 0;
+			for (c = 0; c < q; c++)
+				t += B[(INT64)i * q + c] * H[c*q + q - 1 - j];
+			V[(INT64)i * k + j] = t;
+		}
+	}
+	tiled_backward(pTiled, V, k);
+
+	for (j = 0; j < k; j++){
+		if (!(mu[q - 1 - j] > q * 2.22e-16 * mu[q - 1])){
+			for (i = 0; i < d; i++)
+				V[(INT64)i * k + j] = 0;
+			if (eigenvalue)
+				eigenvalue[j] = 0;
+			continue;
+		}
+		t = 0;
+		for (i = 0; i < d; i++){
+			if (fabs(V[(INT64)i * k + j]) > fabs(t))
+				t = V[(INT64)i * k + j];
+		}
+		for (i = 0; i < d; i++)
+			V[(INT64)i * k + j] /= t;
+		if (eigenvalue)
+			eigenvalue[j] = mu[q - 1 - j];
+	}
+	ret = 0;
+
+L_EXIT:
+
+	if (D)
+		free(D);
+	if (B)
+		free(B);
+	if (H)
+		free(H);
+	if (mu)
+		free(mu);
+	if (T)
+		free(T);
+
+	return ret;
+}
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "base_types.h"
+
+//   Eigenvalues and eigenvectors of a real symmetric matrix.
+//
+//     A = V * diag(w) * V'
+//
+//     Householder reduction to tridiagonal form followed by the implicit QL
+//     iteration, adapted from the EISPACK routines tred2 and tql2. The n*n
+//     matrix is row-major and only its lower triangle is read. It is
+//     overwritten by the orthonormal eigenvectors, column i (a[row*n+i])
+//     belonging to w[i]; the eigenvalues come out in ascending order.
+
+static void tred2(int n, double *v, double *d, double *e)
+{
+	double f, g, h, hh, scale;
+	int i, j, k;
+
+	for (j = 0; j < n; j++)
+		d[j] = v[(n-1)*n + j];
+
+	for (i = n - 1; i > 0; i--)
+	{
+		// scale to avoid under/overflow
+		scale = 0;
+		h = 0;
+		for (k = 0; k < i; k++)
+			scale += fabs(d[k]);
+		if (scale == 0)
+		{
+			e[i] = d[i-1];
+			for (j = 0; j < i; j++)
+			{
+				d[j] = v[(i-1)*n + j];
+				v[i*n + j] = 0;
+				v[j*n + i] = 0;
+			}
+		}
+		else
+		{
+			// generate the Householder vector
+			for (k = 0; k < i; k++)
+			{
+				d[k] /= scale;
+				h += d[k] * d[k];
+			}
+			f = d[i-1];
+			g = sqrt(h);
+			if (f > 0)
+				g = -g;
+			e[i] = scale * g;
+			h = h - f * g;
+			d[i-1] = f - g;
+			for (j = 0; j < i; j++)
+				e[j] = 0;
+
+			// apply the similarity transformation to the remaining columns
+			for (j = 0; j < i; j++)
+			{
+				f = d[j];
+				v[j*n + i] = f;
+				g = e[j] + v[j*n + j] * f;
+				for (k = j + 1; k <= i - 1; k++)
+				{
+					g += v[k*n + j] * d[k];
+					e[k] += v[k*n + j] * f;
+				}
+				e[j] = g;
+			}
+			f = 0;
+			for (j = 0; j < i; j++)
+			{
+				e[j] /= h;
+				f += e[j] * d[j];
+			}
+			hh = f / (h + h);
+			for (j = 0; j < i; j++)
+				e[j] -= hh * d[j];
+			for (j = 0; j < i; j++)
+			{
+				f = d[j];
+				g = e[j];
+				for (k = j; k <= i - 1; k++)
+					v[k*n + j] -= (f * e[k] + g * d[k]);
+				d[j] = v[(i-1)*n + j];
+				v[i*n + j] = 0;
+			}
+		}
+		d[i] = h;
+	}
+
+	// accumulate the transformations
+	for (i = 0; i < n - 1; i++)
+	{
+		v[(n-1)*n + i] = v[i*n + i];
+		v[i*n + i] = 1;
+		h = d[i+1];
+		if (h != 0)
+		{
+			for (k = 0; k <= i; k++)
+				d[k] = v[k*n + i + 1] / h;
+			for (j = 0; j <= i; j++)
+			{
+				g = 0;
+				for (k = 0; k <= i; k++)
+					g += v[k*n + i + 1] * v[k*n + j];
+				for (k = 0; k <= i; k++)
+					v[k*n + j] -= g * d[k];
+			}
+		}
+		for (k = 0; k <= i; k++)
+			v[k*n + i + 1] = 0;
+	}
+	for (j = 0; j < n; j++)
+	{
+		d[j] = v[(n-1)*n + j];
+		v[(n-1)*n + j] = 0;
+	}
+	v[(n-1)*n + n - 1] = 1;
+	e[0] = 0;
+}
+
+static int tql2(int n, double *v, double *d, double *e)
+{
+	static const double eps = 2.22044604925031308085e-16;
+	double f, g, h, p, r, c, c2, c3, s, s2, dl1, el1, tst1;
+	int i, j, k, l, m, iter;
+
+	for (i = 1; i < n; i++)
+		e[i-1] = e[i];
+	e[n-1] = 0;
+
+	f = 0;
+	tst1 = 0;
+	for (l = 0; l < n; l++)
+	{
+		// find a small subdiagonal element
+		tst1 = fabs(d[l]) + fabs(e[l]) > tst1 ? fabs(d[l]) + fabs(e[l]) : tst1;
+		m = l;
+		while (m < n)
+		{
+			if (fabs(e[m]) <= eps * tst1)
+				break;
+			m++;
+		}
+
+		// if m == l, d[l] is an eigenvalue, otherwise iterate
+		if (m > l)
+		{
+			iter = 0;
+			do
+			{
+				if (++iter > 30 * n)
+					return -1;
+
+				// compute the implicit shift
+				g = d[l];
+				p = (d[l+1] - g) / (2 * e[l]);
+				r = hypot(p, 1.0);
+				if (p < 0)
+					r = -r;
+				d[l] = e[l] / (p + r);
+				d[l+1] = e[l] * (p + r);
+				dl1 = d[l+1];
+				h = g - d[l];
+				for (i = l + 2; i < n; i++)
+					d[i] -= h;
+				f += h;
+
+				// implicit QL transformation
+				p = d[m];
+				c = 1;
+				c2 = c;
+				c3 = c;
+				el1 = e[l+1];
+				s = 0;
+				s2 = 0;
+				for (i = m - 1; i >= l; i--)
+				{
+					c3 = c2;
+					c2 = c;
+					s2 = s;
+					g = c * e[i];
+					h = c * p;
+					r = hypot(p, e[i]);
+					e[i+1] = s * r;
+					s = e[i] / r;
+					c = p / r;
+					p = c * d[i] - s * g;
+					d[i+1] = h + s * (c * g + s * d[i]);
+
+					// accumulate the transformation
+					for (k = 0; k < n; k++)
+					{
+						h = v[k*n + i + 1];
+						v[k*n + i + 1] = s * v[k*n + i] + c * h;
+						v[k*n + i] = c * v[k*n + i] - s * h;
+					}
+				}
+				p = -s * s2 * c3 * el1 * e[l] / dl1;
+				e[l] = s * p;
+				d[l] = c * p;
+
+			} while (fabs(e[l]) > eps * tst1);
+		}
+		d[l] = d[l] + f;
+		e[l] = 0;
+	}
+
+	// sort the eigenvalues and vectors in ascending order
+	for (i = 0; i < n - 1; i++)
+	{
+		k = i;
+		p = d[i];
+		for (j = i + 1; j < n; j++)
+		{
+			if (d[j] < p)
+			{
+				k = j;
+				p = d[j];
+			}
+		}
+		if (k != i)
+		{
+			d[k] = d[i];
+			d[i] = p;
+			for (j = 0; j < n; j++)
+			{
+				p = v[j*n + i];
+				v[j*n + i] = v[j*n + k];
+				v[j*n + k] = p;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// Returns 0, or -1 when the QL iteration does not converge.
+int SymmetricEigenDecomposition(int n, double *a, double *w)
+{
+	double *e;
+	int i, j, ret;
+
+	if (n <= 0)
+		return -1;
+	e = (double *)malloc(sizeof(double) * n);
+	if (e == NULL)
+		return -1;
+
+	// tred2 works on the full matrix
+	for (i = 0; i < n; i++)
+	{
+		for (j = i + 1; j < n; j++)
+			a[i*n + j] = a[j*n + i];
+	}
+	tred2(n, a, w, e);
+	ret = tql2(n, a, w, e);
+
+	free(e);
+
+	return ret;
+}
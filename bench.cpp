@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+#include "LDAApi.h"
+#include "LDAKernel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+	typedef unsigned __int64 UINT64;
+#else
+#include <sys/resource.h>
+	typedef unsigned long long UINT64;
+#endif
+
+#ifndef MAX
+#define MAX(a,b)	((a) >= (b) ? (a) : (b))
+#endif
+#ifndef MIN
+#define MIN(a,b)	((a) <= (b) ? (a) : (b))
+#endif
+
+//   Benchmark of ingestion, solve and projection on synthetic Gaussian
+//   class mixtures. Built apart from the demo, from every source but
+//   main.cpp:
+//
+//     g++ -O2 -o bench bench.cpp <all other .cpp but main.cpp> -lpthread
+//
+//     Class c draws x = m_c + H * (sqrt(s) .* z), z standard normal, with
+//     the class means m_c ~ N(0, sep^2) per feature, s log-spaced from 1
+//     down to 1/cond (so cond is the condition number of the within-class
+//     covariance) and H a product of two random Householder reflections,
+//     which rotates the spectrum off the axes at O(d) per row. A fraction
+//     'sparsity' of the entries is then set to zero. Everything derives
+//     from the seed, so a configuration always produces the same rows.
+//
+//     Every repetition ingests the rows into a fresh handle, solves and
+//     projects. The report, JSON on stdout, gives the best and the median
+//     time of each phase, rows/s, GFLOP/s and the peak resident set. The
+//     flops of ingestion are d*(d+1) + 3*d per row (the upper triangle of
+//     the outer product, shift and class sum), of projection 2*d*k per row;
+//     the QZ solve is rated at the nominal 46*d^3 of the QZ algorithm with
+//     Z accumulated (Golub & Van Loan), which is a yardstick across
+//     versions rather than a count.
+
+typedef struct GEN {
+	UINT64 s;
+	BOOL bSpare;
+	double spare;
+} GEN;
+
+// splitmix64
+static UINT64 gen_next(GEN *pGen)
+{
+	UINT64 z = (pGen->s += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// uniform in (0, 1)
+static double gen_uniform(GEN *pGen)
+{
+	return ((gen_next(pGen) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// standard normal, Box-Muller
+static double gen_normal(GEN *pGen)
+{
+	double r, t;
+
+	if (pGen->bSpare){
+		pGen->bSpare = FALSE;
+		return pGen->spare;
+	}
+	r = sqrt(-2 * log(gen_uniform(pGen)));
+	t = 6.283185307179586 * gen_uniform(pGen);
+	pGen->spare = r * sin(t);
+	pGen->bSpare = TRUE;
+	return r * cos(t);
+}
+
+typedef struct CONFIG {
+	INT d;
+	INT q;
+	INT n;
+	INT k;				// projected dimensions
+	INT reps;
+	INT threads;
+	double sparsity;
+	double cond;
+	double sep;
+	UINT64 seed;
+	const char *solver;	// qz, path or range
+	INT perf;			// hardware counters around each phase
+} CONFIG;
+
+// n rows of the mixture into v, labels into label
+static void generate(const CONFIG *pCfg, double *v, INT *label)
+{
+	GEN gen;
+	INT d = pCfg->d;
+	INT q = pCfg->q;
+	double *M, *s, *u, *x;
+	double t;
+	INT r, i, h, c;
+
+	memset(&gen, 0, sizeof(gen));
+	gen.s = pCfg->seed;
+
+	M = (double *)malloc(sizeof(double) * q * d);
+	s = (double *)malloc(sizeof(double) * d);
+	u = (double *)malloc(sizeof(double) * 2 * d);
+
+	for (i = 0; i < q * d; i++)
+		M[i] = pCfg->sep * gen_normal(&gen);
+	for (i = 0; i < d; i++)
+		s[i] = sqrt(pow(pCfg->cond, (d > 1) ? -(double)i / (d - 1) : 0));
+	// unit Householder vectors
+	for (h = 0; h < 2; h++){
+		t = 0;
+		for (i = 0; i < d; i++){
+			u[h*d + i] = gen_normal(&gen);
+			t += u[h*d + i] * u[h*d + i];
+		}
+		t = 1 / sqrt(t);
+		for (i = 0; i < d; i++)
+			u[h*d + i] *= t;
+	}
+
+	for (r = 0; r < pCfg->n; r++){
+		c = (INT)(gen_next(&gen) % q);
+		label[r] = c;
+		x = v + (size_t)r * d;
+		for (i = 0; i < d; i++)
+			x[i] = s[i] * gen_normal(&gen);
+		for (h = 0; h < 2; h++){
+			t = 0;
+			for (i = 0; i < d; i++)
+				t += u[h*d + i] * x[i];
+			for (i = 0; i < d; i++)
+				x[i] -= 2 * t * u[h*d + i];
+		}
+		for (i = 0; i < d; i++){
+			x[i] += M[c*d + i];
+			if (pCfg->sparsity > 0 && gen_uniform(&gen) < pCfg->sparsity)
+				x[i] = 0;
+		}
+	}
+
+	free(M);
+	free(s);
+	free(u);
+}
+
+static double seconds(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double peak_rss(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return (double)pmc.PeakWorkingSetSize;
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	return (double)ru.ru_maxrss * 1024;
+#endif
+}
+
+static double median(double *t, INT n)
+{
+	std::sort(t, t + n);
+	return (n % 2) ? t[n / 2] : 0.5 * (t[n/2 - 1] + t[n / 2]);
+}
+
+static double best(const double *t, INT n)
+{
+	return *std::min_element(t, t + n);
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-d dim] [-q classes] [-n rows] [-k proj] [-sparsity f] [-cond c] [-sep s]\n"
+		"       [-seed s] [-reps r] [-threads t] [-solver qz|path|range] [-perf 0|1]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	CONFIG cfg;
+	HANDLE hLDA = NULL;
+	double *v = NULL;
+	double *V = NULL;
+	double *w = NULL;
+	double *u = NULL;
+	INT *label = NULL;
+	double *tAdd = NULL;
+	double *tSolve = NULL;
+	double *tProject = NULL;
+	LDA_STATS stats, bestStats;
+	double t0, lambda = 0;
+	double fAdd, fSolve, fProject;
+	INT i, r, nb, rank, ret = -1;
+
+	cfg.d = 64;
+	cfg.q = 8;
+	cfg.n = 100000;
+	cfg.k = 0;
+	cfg.reps = 5;
+	cfg.threads = 1;
+	cfg.sparsity = 0;
+	cfg.cond = 100;
+	cfg.sep = 1;
+	cfg.seed = 1;
+	cfg.solver = "qz";
+	cfg.perf = 0;
+
+	for (i = 1; i < argc; i++){
+		if (i + 1 >= argc){
+			usage(argv[0]);
+			return -1;
+		}
+		if (strcmp(argv[i], "-d") == 0)
+			cfg.d = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-q") == 0)
+			cfg.q = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0)
+			cfg.n = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-k") == 0)
+			cfg.k = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-reps") == 0)
+			cfg.reps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-threads") == 0)
+			cfg.threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-sparsity") == 0)
+			cfg.sparsity = atof(argv[++i]);
+		else if (strcmp(argv[i], "-cond") == 0)
+			cfg.cond = atof(argv[++i]);
+		else if (strcmp(argv[i], "-sep") == 0)
+			cfg.sep = atof(argv[++i]);
+		else if (strcmp(argv[i], "-seed") == 0)
+			cfg.seed = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-solver") == 0)
+			cfg.solver = argv[++i];
+		else if (strcmp(argv[i], "-perf") == 0)
+			cfg.perf = atoi(argv[++i]);
+		else {
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (cfg.k == 0)
+		cfg.k = MAX(1, cfg.q - 1);
+	if (cfg.d <= 0 || cfg.q <= 1 || cfg.q > cfg.d || cfg.n < cfg.q || cfg.k > cfg.q || cfg.reps <= 0 ||
+		cfg.threads < 0 || !(cfg.sparsity >= 0 && cfg.sparsity < 1) || !(cfg.cond >= 1) ||
+		(strcmp(cfg.solver, "qz") != 0 && strcmp(cfg.solver, "path") != 0 && strcmp(cfg.solver, "range") != 0)){
+		usage(argv[0]);
+		return -1;
+	}
+
+	v = (double *)malloc(sizeof(double) * (size_t)cfg.n * cfg.d);
+	label = (INT *)malloc(sizeof(INT) * cfg.n);
+	V = (double *)malloc(sizeof(double) * cfg.d * cfg.d);
+	w = (double *)malloc(sizeof(double) * cfg.d);
+	u = (double *)malloc(sizeof(double) * (size_t)cfg.n * cfg.k);
+	tAdd = (double *)malloc(sizeof(double) * cfg.reps);
+	tSolve = (double *)malloc(sizeof(double) * cfg.reps);
+	tProject = (double *)malloc(sizeof(double) * cfg.reps);
+	if (v == NULL || label == NULL || V == NULL || w == NULL || u == NULL || tAdd == NULL || tSolve == NULL ||
+		tProject == NULL){
+		fprintf(stderr, "ERROR: out of memory\n");
+		goto L_EXIT;
+	}
+
+	generate(&cfg, v, label);
+	memset(&bestStats, 0, sizeof(bestStats));
+
+	// counted over all repetitions, after the data exists; the counter
+	// reads add a little to every timed phase
+	if (cfg.perf && LDA_PerfEnable(TRUE) < 0)
+		fprintf(stderr, "WARNING: no performance counters on this host\n");
+
+	for (r = 0; r < cfg.reps; r++){
+		hLDA = LDA_Create(cfg.d, cfg.q);
+		if (hLDA == NULL || LDA_SetThreads(hLDA, cfg.threads) != 0){
+			fprintf(stderr, "ERROR: LDA_Create failed\n");
+			goto L_EXIT;
+		}
+
+		// ingestion in batches, as from a reader
+		t0 = seconds();
+		for (i = 0; i < cfg.n; i += nb){
+			nb = MIN(4096, cfg.n - i);
+			if (LDA_AddBatch(hLDA, v + (size_t)i * cfg.d, label + i, nb) < 0){
+				fprintf(stderr, "ERROR: LDA_AddBatch failed\n");
+				goto L_EXIT;
+			}
+		}
+		tAdd[r] = seconds() - t0;
+
+		// the solvers differ in their eigenvector layout; the projection
+		// takes row stride d for qz and k for the others
+		t0 = seconds();
+		if (strcmp(cfg.solver, "qz") == 0)
+			i = LDA_Solve(hLDA, V, w);
+		else if (strcmp(cfg.solver, "path") == 0)
+			i = LDA_SolvePath(hLDA, &lambda, 1, cfg.k, V, w);
+		else
+			i = LDA_SolveRange(hLDA, cfg.k, V, w, &rank);
+		tSolve[r] = seconds() - t0;
+		if (i != 0){
+			fprintf(stderr, "ERROR: %s solve failed\n", cfg.solver);
+			goto L_EXIT;
+		}
+		if (strcmp(cfg.solver, "qz") == 0){
+			LDA_SolveStats(hLDA, &stats);
+			if (r == 0 || stats.tTotal < bestStats.tTotal)
+				bestStats = stats;
+		}
+		else {
+			// compact d*k into the d*d layout of LDA_Project
+			for (i = cfg.d - 1; i >= 0; i--)
+				memmove(V + (size_t)i * cfg.d, V + (size_t)i * cfg.k, sizeof(double) * cfg.k);
+		}
+
+		t0 = seconds();
+		LDA_Project(V, cfg.d, cfg.k, v, cfg.n, u);
+		tProject[r] = seconds() - t0;
+
+		LDA_Release(hLDA);
+		hLDA = NULL;
+	}
+
+	fAdd = (double)cfg.n * ((double)cfg.d * (cfg.d + 1) + 3.0 * cfg.d);
+	fSolve = 46.0 * cfg.d * cfg.d * cfg.d;
+	fProject = 2.0 * cfg.n * cfg.d * cfg.k;
+
+	printf("{\n");
+	printf("  \"config\": {\"d\": %d, \"q\": %d, \"n\": %d, \"k\": %d, \"sparsity\": %g, \"cond\": %g, \"sep\": %g, "
+		"\"seed\": %llu, \"reps\": %d, \"threads\": %d, \"solver\": \"%s\", \"kernel\": \"%s\"},\n",
+		cfg.d, cfg.q, cfg.n, cfg.k, cfg.sparsity, cfg.cond, cfg.sep, (unsigned long long)cfg.seed, cfg.reps,
+		cfg.threads, cfg.solver, lda_kernel()->name);
+	printf("  \"add\": {\"best_s\": %.6g, \"median_s\": %.6g, \"rows_per_s\": %.6g, \"gflops\": %.4g},\n",
+		best(tAdd, cfg.reps), median(tAdd, cfg.reps), cfg.n / best(tAdd, cfg.reps), fAdd / best(tAdd, cfg.reps) * 1e-9);
+	printf("  \"solve\": {\"best_s\": %.6g, \"median_s\": %.6g", best(tSolve, cfg.reps), median(tSolve, cfg.reps));
+	if (strcmp(cfg.solver, "qz") == 0){
+		printf(", \"gflops_nominal\": %.4g,\n", fSolve / (bestStats.tQzhes + bestStats.tQzit + bestStats.tQzval +
+			bestStats.tQzvec) * 1e-9);
+		printf("    \"phases_s\": {\"gather\": %.6g, \"qzhes\": %.6g, \"qzit\": %.6g, \"qzval\": %.6g, \"qzvec\": %.6g, "
+			"\"classifier\": %.6g}", bestStats.tGather, bestStats.tQzhes, bestStats.tQzit, bestStats.tQzval,
+			bestStats.tQzvec, bestStats.tClassifier);
+		printf(",\n    \"qz\": {\"iterations\": %d, \"deflations\": %d, \"ierr\": %d, \"infinite\": %d, "
+			"\"rcond_sw\": %.3g}", bestStats.nIter, bestStats.nDeflate, bestStats.ierr, bestStats.nInfinite,
+			bestStats.rcond);
+	}
+	printf("},\n");
+	printf("  \"project\": {\"best_s\": %.6g, \"median_s\": %.6g, \"rows_per_s\": %.6g, \"gflops\": %.4g},\n",
+		best(tProject, cfg.reps), median(tProject, cfg.reps), cfg.n / best(tProject, cfg.reps),
+		fProject / best(tProject, cfg.reps) * 1e-9);
+	printf("  \"peak_rss_bytes\": %.0f", peak_rss());
+	if (cfg.perf){
+		printf(",\n  \"perf\": ");
+		fflush(stdout);
+		LDA_PerfReport(NULL);
+	}
+	printf("\n}\n");
+	ret = 0;
+
+L_EXIT:
+
+	if (hLDA)
+		LDA_Release(hLDA);
+	if (v)
+		free(v);
+	if (label)
+		free(label);
+	if (V)
+		free(V);
+	if (w)
+		free(w);
+	if (u)
+		free(u);
+	if (tAdd)
+		free(tAdd);
+	if (tSolve)
+		free(tSolve);
+	if (tProject)
+		free(tProject);
+
+	return ret;
+}
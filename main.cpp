@@ -8,7 +8,6 @@ int DimReduction(const double *eigenvector, const double *v, const int d, double
 {
 	double *W = (double *)eigenvector;
 	double *y = NULL;
-	int i, j;
 
 	if (W == NULL)
 		return -1;
@@ -23,11 +22,7 @@ int DimReduction(const double *eigenvector, const double *v, const int d, double
 	}
 
 	// Y=X*W;
-	for (i = 0; i < k; i++){
-		y[i] = 0;
-		for (j = 0; j < d; j++)
-			y[i] += v[j] * W[i+j*d];
-	}
+	LDA_Project(W, d, k, v, 1, y);
 
 	if (v == u){
 		memcpy(u, y, sizeof(double) * k);
@@ -37,37 +32,160 @@ int DimReduction(const double *eigenvector, const double *v, const int d, double
 	return 0;
 }
 
-int main(int argc, char *argv[])
-{
-    HANDLE hLDA;
-    int i, j, k;
 #define LEN 4
-    double eigenvector[LEN*LEN];
-    double eigenvalue[LEN];
 
-    hLDA= LDA_Create(LEN, 3);
+// main convert <txt> <bin> [f32|f64]
+static int Convert(int argc, char *argv[])
+{
+	int type = LDA_FLOAT64;
+	int q;
+
+	if (argc < 4){
+		printf("usage: %s convert <txt> <bin> [f32|f64]\n", argv[0]);
+		return -1;
+	}
+	if (argc > 4 && strcmp(argv[4], "f32") == 0)
+		type = LDA_FLOAT32;
 
-	FILE *fp = fopen(argv[1], "r");
-	if (fp == NULL){
-		printf("ERROR: failed to open file [%s].\n", argv[1]);
+	q = LDA_DatasetConvert(argv[2], argv[3], LEN, type);
+	if (q < 0){
+		printf("ERROR: failed to convert [%s] to [%s].\n", argv[2], argv[3]);
 		return -1;
 	}
+	printf("%s: %d classes\n", argv[3], q);
+	return 0;
+}
+
+// trains from a binary dataset or (possibly compressed) text, and saves
+// the model when a model file is given
+static int Train(const char *file, double *eigenvector, double *eigenvalue, const char *model)
+{
+	HANDLE hLDA;
+	HANDLE hSet;
+	HANDLE hStream;
+	int ret;
+
+	hLDA = LDA_Create(LEN, 3);
 
-	float f;
-	double v[LEN+1];
-	while (!feof(fp)){
-		for (j = 0; j < LEN+1; j++){
-			if (fscanf(fp, "%f", &f) != 1)
-				break;
-			v[j] = f;
+	// binary datasets are mapped and fed to the accumulator in place
+	hSet = LDA_DatasetOpen(file);
+	if (hSet != NULL){
+		ret = LDA_DatasetAdd(hLDA, hSet);
+		LDA_DatasetClose(hSet);
+	}
+	else {
+		// text input may be gzip/zstd compressed
+		hStream = LDA_StreamOpen(file);
+		if (hStream == NULL){
+			printf("ERROR: failed to open file [%s].\n", file);
+			LDA_Release(hLDA);
+			return -1;
 		}
-		if (j == LEN+1)
-			LDA_Add(hLDA, v, (int)v[LEN] - 1);
+		ret = LDA_StreamAdd(hLDA, hStream, 1);
+		LDA_StreamClose(hStream);
 	}
 
-    LDA_Solve(hLDA, eigenvector, eigenvalue);
+	if (ret >= 0)
+		ret = LDA_Solve(hLDA, eigenvector, eigenvalue);
+	if (ret >= 0 && model != NULL){
+		ret = LDA_SaveModel(hLDA, model, LEN);
+		if (ret != 0)
+			printf("ERROR: failed to write model [%s].\n", model);
+	}
 	LDA_Release(hLDA);
 
+	return ret;
+}
+
+// main train <data> <model>
+static int TrainModel(int argc, char *argv[])
+{
+	double eigenvector[LEN*LEN];
+	double eigenvalue[LEN];
+
+	if (argc < 4){
+		printf("usage: %s train <data> <model>\n", argv[0]);
+		return -1;
+	}
+	return Train(argv[2], eigenvector, eigenvalue, argv[3]);
+}
+
+// main project <model> [input|-] [-o out] [-k dims] [-p decimals] [-l] [-b|-f]
+static int Project(int argc, char *argv[])
+{
+	const char *input = "-";
+	const char *output = "-";
+	int k = LEN, precision = 6, type = 0;
+	BOOL bLabel = FALSE;
+	HANDLE hModel;
+	HANDLE hStream;
+	int i, n;
+
+	if (argc < 3){
+		printf("usage: %s project <model> [input|-] [-o out] [-k dims] [-p decimals] [-l] [-b|-f]\n", argv[0]);
+		return -1;
+	}
+	for (i = 3; i < argc; i++){
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+			k = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			precision = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-l") == 0)
+			bLabel = TRUE;
+		else if (strcmp(argv[i], "-b") == 0)
+			type = LDA_FLOAT64;
+		else if (strcmp(argv[i], "-f") == 0)
+			type = LDA_FLOAT32;
+		else
+			input = argv[i];
+	}
+
+	hModel = LDA_LoadModel(argv[2], TRUE);
+	if (hModel == NULL){
+		fprintf(stderr, "ERROR: failed to load model [%s].\n", argv[2]);
+		return -1;
+	}
+	hStream = LDA_StreamOpen(input);
+	if (hStream == NULL){
+		fprintf(stderr, "ERROR: failed to open file [%s].\n", input);
+		LDA_ModelRelease(hModel);
+		return -1;
+	}
+	n = LDA_StreamProject(hStream, hModel, k, bLabel, output, type, precision);
+	LDA_StreamClose(hStream);
+	LDA_ModelRelease(hModel);
+	if (n < 0){
+		fprintf(stderr, "ERROR: projection failed.\n");
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    HANDLE hSet;
+    HANDLE hStream;
+    int i, j;
+    double eigenvector[LEN*LEN];
+    double eigenvalue[LEN];
+    double v[LEN+1];
+
+	if (argc < 2){
+		printf("usage: %s <data> | convert <txt> <bin> [f32|f64] | train <data> <model> | project <model> [input]\n", argv[0]);
+		return -1;
+	}
+	if (strcmp(argv[1], "convert") == 0)
+		return Convert(argc, argv);
+	if (strcmp(argv[1], "train") == 0)
+		return TrainModel(argc, argv);
+	if (strcmp(argv[1], "project") == 0)
+		return Project(argc, argv);
+
+	if (Train(argv[1], eigenvector, eigenvalue, NULL) != 0)
+		return -1;
+
     for(i=0; i<LEN; i++){
         for(j=0; j<LEN; j++){
             printf("%9.4f ", eigenvector[i + j*LEN]);
@@ -76,23 +194,41 @@ int main(int argc, char *argv[])
     }
 	printf("\n");
 
-	fseek(fp, 0L, SEEK_SET);
-	i = 0;
-	while (!feof(fp)){
-		for (j = 0; j < LEN+1; j++){
-			if (fscanf(fp, "%f", &f) != 1)
-				break;
-			v[j] = f;
-		}
-		if (j == LEN+1){
+	hSet = LDA_DatasetOpen(argv[1]);
+	if (hSet != NULL){
+		const void *data;
+		int type, n;
+
+		n = LDA_DatasetRows(hSet, &data, NULL);
+		LDA_DatasetInfo(hSet, NULL, NULL, NULL, &type);
+		for (i = 0; i < n; i++){
+			for (j = 0; j < LEN; j++){
+				if (type == LDA_FLOAT32)
+					v[j] = ((const float *)data)[i*LEN + j];
+				else
+					v[j] = ((const double *)data)[i*LEN + j];
+			}
 			DimReduction(eigenvector, v, LEN, v, LEN);
 			printf("%d.", i+1);
 			for (j = 0; j < LEN; j++)
 				printf(" %.2f,", v[j]);
 			printf("\n");
-			i++;
 		}
+		LDA_DatasetClose(hSet);
+		return 0;
+	}
+
+	hStream = LDA_StreamOpen(argv[1]);
+	i = 0;
+	while (LDA_StreamRead(hStream, v, LEN+1) == LEN+1){
+		DimReduction(eigenvector, v, LEN, v, LEN);
+		printf("%d.", i+1);
+		for (j = 0; j < LEN; j++)
+			printf(" %.2f,", v[j]);
+		printf("\n");
+		i++;
 	}
+	LDA_StreamClose(hStream);
 
     return 0;
 }